@@ -0,0 +1,63 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _CODEIMAGE_H
+#define _CODEIMAGE_H
+
+#include <stdint.h>
+
+/*
+    Image of the translation cache built offline by tools/aot. It lists entry points of units
+    found in the executable, relative to the segment they live in, so that it stays valid no
+    matter where the executable is loaded. The image is appended to the executable in the
+    initrd, the trailer in the last eight bytes of the initrd points to it. All fields are
+    big endian.
+*/
+#define CI_MAGIC        0x45363843  /* "E68C" */
+#define CI_VERSION      1
+
+struct CodeImageHeader {
+    uint32_t    ci_Magic;
+    uint32_t    ci_Version;
+    uint32_t    ci_FileSize;        /* Size of the executable the image was built from */
+    uint32_t    ci_FileCRC;         /* CRC32 of the executable */
+    uint32_t    ci_EntryCount;
+    uint32_t    ci_Reserved;
+};
+
+struct CodeImageEntry {
+    uint32_t    ce_Segment;         /* Hunk number or ELF section index */
+    uint32_t    ce_Offset;          /* Offset of the entry point within the segment */
+};
+
+struct CodeImageTrailer {
+    uint32_t    ct_Offset;          /* Offset of the header from start of the initrd */
+    uint32_t    ct_Magic;
+};
+
+/* Plain bitwise CRC32, it has to give the same result on the host and on Emu68 */
+static inline uint32_t CodeImage_CRC32(const void *data, uint32_t size)
+{
+    const uint8_t *p = data;
+    uint32_t crc = 0xffffffff;
+
+    while (size--)
+    {
+        crc ^= *p++;
+        for (int i=0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
+
+int CodeImage_Attach(void *file, void *file_end, void *seglist);
+void CodeImage_Preload(uint16_t *entry);
+
+#endif /* _CODEIMAGE_H */
@@ -14,7 +14,7 @@
 #include <stdarg.h>
 
 #include "nodes.h"
-#include "md5.h"
+#include "fingerprint.h"
 #include "lists.h"
 
 struct M68KLocalState {
@@ -22,10 +22,97 @@ struct M68KLocalState {
     uint32_t        mls_ARMOffset;
     uint8_t         mls_RegMap[16];
     int32_t         mls_PCRel;
+    uint8_t         mls_Flushed;    /* No m68k state cached in temporary registers, loop head candidate */
+    uint8_t         mls_Modified[3];    /* Temporaries holding modified CC, FPCR and FPSR, 0xff if none */
 };
 
+struct M68KTranslationUnit;
+
+/*
+    Exit of a translation unit with a PC known at translation time. If the target unit
+    is present in the cache, the exit is chained to it with a direct branch and the link
+    is kept on target's mt_Incoming list. Otherwise it waits in the list of pending exits.
+
+    Indirect exits (JSR, JMP, RTS) carry a small inline cache of PC -> entry point pairs.
+    Every slot of the cache has its own link, which is idle as long as the slot is empty.
+*/
+struct M68KExitLink {
+    struct Node     el_Node;
+    struct M68KTranslationUnit * el_Owner;
+    struct M68KTranslationUnit * el_Target;
+    uint16_t *      el_M68kTarget;
+    uint32_t        el_Offset;
+    uint32_t        el_Type;
+    uint32_t        el_Count;
+};
+
+#define EXIT_DIRECT     0
+#define EXIT_INDIRECT   1
+
+/*
+    Entry of a unit in the page index. A unit has one link for every 4K page of m68k memory its
+    code overlaps, so that invalidation of a cache line or page finds it without a walk over
+    all units.
+*/
+struct M68KPageLink {
+    struct Node     pl_Node;
+    struct M68KTranslationUnit * pl_Unit;
+};
+
+struct M68KIndirectSlot {
+    uint32_t        is_M68kPC;
+    uint32_t        is_Pad;
+    void *          is_ARMEntryPoint;
+};
+
+#define IBTC_SLOTS      4
+#define IBTC_EMPTY      1
+
+/*
+    Translation cache is an open addressing hash table with linear probing. Every bucket
+    fills exactly one cache line and holds four entries. Units are referenced by their offset
+    from the beginning of JIT memory pool.
+*/
+struct M68KICacheBucket {
+    uint32_t        cb_M68kPC[4];
+    uint32_t        cb_Unit[4];
+    void *          cb_ARMEntryPoint[4];
+} __attribute__((aligned(64)));
+
+#define ICACHE_BUCKET_SLOTS     4
+#define ICACHE_INITIAL_BUCKETS  8192
+#define ICACHE_EMPTY            0xffffffff
+#define ICACHE_HASH(pc)         ((((uint32_t)(uintptr_t)(pc)) ^ ((uint32_t)(uintptr_t)(pc) >> 14)) >> 1)
+
+/*
+    Direct mapped jump cache checked by ExecutionLoop before the hash table is searched.
+    It holds entry points of recently dispatched units only, together with offset of the unit
+    descriptor from jit_tlsf, so that a hit can set the reference bit of the unit.
+*/
+struct M68KJumpCacheEntry {
+    uint32_t        jc_M68kPC;
+    uint32_t        jc_Unit;
+    void *          jc_ARMEntryPoint;
+};
+
+#define JCACHE_BITS             12
+#define JCACHE_SIZE             (1 << JCACHE_BITS)
+#define JCACHE_INDEX(pc)        (((uint32_t)(uintptr_t)(pc) >> 1) & (JCACHE_SIZE - 1))
+
+/*
+    Reasons to verify the unit before it is entered. Units on pages which cannot be protected
+    are verified on every run with the cache disabled. Suspect units, left over from the last
+    full flush of the cache, are verified once on their next entry.
+*/
+#define VERIFY_ALWAYS           1
+#define VERIFY_SUSPECT          2
+#define VERIFYB_SUSPECT         1
+
+/*
+    Descriptor of a translation unit. Descriptors live in a separate array, the ARM code
+    itself is kept in the code regions and contains no bookkeeping data.
+*/
 struct M68KTranslationUnit {
-    struct Node     mt_HashNode;
     struct Node     mt_LRUNode;
     uint16_t *      mt_M68kAddress;
     uint16_t *      mt_M68kLow;
@@ -35,19 +122,39 @@ struct M68KTranslationUnit {
     uint32_t        mt_Conditionals;
     uint32_t        mt_M68kInsnCnt;
     uint32_t        mt_ARMInsnCnt;
+    uint32_t        mt_OptimizedCnt;    /* Host instructions removed by IR passes */
     uint64_t        mt_UseCount;
     uint64_t        mt_FetchCount;
     void *          mt_ARMEntryPoint;
-    struct M68KLocalState *  mt_LocalState;
-    struct MD5      mt_MD5;
-    uint32_t        mt_ARMCode[]
-#ifdef __aarch64__
-    __attribute__((aligned(64)));
-#else
-     __attribute__((aligned(32)));
-#endif
+    uint32_t *      mt_ARMCode;
+    uint8_t *       mt_PCMap;           /* Side table mapping host code to m68k PC */
+    struct List     mt_Incoming;
+    uint32_t        mt_ExitCount;
+    uint32_t        mt_Size;
+    uint32_t        mt_HotCount;
+    uint8_t         mt_Referenced;
+    uint8_t         mt_Tier;
+    uint8_t         mt_Verify;
+    uint32_t        mt_Epoch;
+    struct M68KExitLink * mt_Exits;
+    struct M68KPageLink * mt_Pages;
+    uint32_t        mt_PageCount;
+    struct Fingerprint mt_Fingerprint;
+};
+
+/*
+    Entry of the return address stack of translated code. Pushed at JSR and BSR leaving the unit,
+    an RTS leaving the unit branches directly to the entry point if the popped address matches.
+*/
+struct M68KReturnEntry {
+    uint32_t        re_M68kPC;
+    uint32_t        re_Pad;
+    void *          re_ARMEntryPoint;
 };
 
+#define RSTACK_BITS     4
+#define RSTACK_SIZE     (1 << RSTACK_BITS)
+
 struct M68KState
 {
     /* Integer part */
@@ -86,6 +193,10 @@ struct M68KState
 
     /* Async IRQ part */
     uint32_t PINT;
+
+    /* Return address stack */
+    uint32_t RSTop;
+    struct M68KReturnEntry RS[RSTACK_SIZE];
 };
 
 #define CACR_DE 0x80000000
@@ -206,6 +317,7 @@ uint32_t *EMIT_FlushPC(uint32_t *ptr);
 uint32_t *EMIT_ResetOffsetPC(uint32_t *ptr);
 uint32_t *EMIT_LoadFromEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *arm_reg, uint8_t ea, uint16_t *m68k_ptr, uint8_t *ext_words, uint8_t read_only, int32_t *imm_offset);
 uint32_t *EMIT_StoreToEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *arm_reg, uint8_t ea, uint16_t *m68k_ptr, uint8_t *ext_words);
+int M68K_GetKnownEA(uint8_t ea, uint16_t *m68k_ptr, uint32_t *address);
 uint32_t *EMIT_Exception(uint32_t *ptr, uint16_t exception, uint8_t format, ...);
 
 uint32_t *EMIT_line0(uint32_t *ptr, uint16_t **m68k_ptr);
@@ -227,6 +339,9 @@ uint32_t *EMIT_InjectDebugStringV(uint32_t *ptr, const char * restrict format, v
 uint32_t *EMIT_InjectDebugString(uint32_t *ptr, const char * restrict format, ...);
 
 void M68K_PushReturnAddress(uint16_t *ret_addr);
+uint32_t *EMIT_PushReturnStack(uint32_t *ptr, uint16_t *ret_addr);
+uint32_t *EMIT_PopReturnStack(uint32_t *ptr);
+void M68K_ClearReturnStack();
 uint16_t *M68K_PopReturnAddress(uint8_t *success);
 void M68K_ResetReturnStack();
 int M68K_GetINSNLength(uint16_t *insn_stream);
@@ -236,8 +351,21 @@ uint8_t EMIT_TestCondition(uint32_t **pptr, uint8_t m68k_condition);
 uint8_t M68K_GetSRMask(uint16_t *m68k_stream);
 void M68K_InitializeCache();
 struct M68KTranslationUnit *M68K_GetTranslationUnit(uint16_t *ptr);
+int M68K_PreloadUnit(uint16_t *ptr);
+int M68K_QueuePreload(uint16_t **list, uint32_t count);
 void *M68K_TranslateNoCache(uint16_t *m68kcodeptr);
 struct M68KTranslationUnit *M68K_VerifyUnit(struct M68KTranslationUnit *unit);
+void M68K_FreeUnit(struct M68KTranslationUnit *unit);
+uint32_t M68K_FreeRange(uintptr_t start, uintptr_t end);
+void M68K_InvalidateAll();
+void *M68K_ResolveIndirect(struct M68KIndirectSlot *slots, uint32_t pc);
+void *M68K_TierUp(struct M68KTranslationUnit *unit);
+int M68K_IsFallThroughHot(uint16_t *ptr);
+void M68K_LockCache();
+void M68K_UnlockCache();
+void M68K_TranslationWorker();
+int M68K_PageWritten(uintptr_t address);
+int M68K_RecoverPC(uintptr_t arm_pc, uint32_t *m68k_pc, uint8_t *modified, int32_t *adjust);
 void M68K_DumpStats();
 uint8_t M68K_GetCC(uint32_t **ptr);
 uint8_t M68K_ModifyCC(uint32_t **ptr);
@@ -245,55 +373,37 @@ void M68K_FlushCC(uint32_t **ptr);
 
 static inline __attribute__((always_inline)) struct M68KTranslationUnit *M68K_FindTranslationUnit(uint16_t *ptr)
 {
-    struct M68KTranslationUnit *unit = NULL, *n;
-    uintptr_t hash = (uintptr_t)ptr;
-    extern struct List *ICache;
-    extern struct List LRU;
-
-    /* Get 16-bit has from the pointer to m68k code */
-    hash = (hash ^ (hash >> 16)) & 0xffff;
-
-    /* Find entry with correct address */
-    ForeachNode(&ICache[hash], n)
+    struct M68KTranslationUnit *unit = NULL;
+    uint32_t pc = (uint32_t)(uintptr_t)ptr;
+    extern struct M68KICacheBucket *ICache;
+    extern uint32_t ICacheMask;
+    extern void *jit_tlsf;
+
+    /* Probe buckets starting at the home one until the entry or an empty slot is found */
+    for (uint32_t b = ICACHE_HASH(pc) & ICacheMask; ; b = (b + 1) & ICacheMask)
     {
-        if (n->mt_M68kAddress == ptr)
-        {
-            /* Unit found? Move it to the front of LRU list */
-            unit = n;
-
-            struct Node *this = &unit->mt_LRUNode;
+        struct M68KICacheBucket *bucket = &ICache[b];
 
+        for (int i=0; i < ICACHE_BUCKET_SLOTS; i++)
+        {
+            if (bucket->cb_M68kPC[i] == pc)
+            {
 #ifdef __aarch64__
-            /* Correct unit found. Preload ICache */
-            //asm volatile ("prfm plil1keep, [%0]"::"r"(unit->mt_ARMEntryPoint));
+                /* Units are published by translation workers, PC is written last */
+                asm volatile("dmb ishld":::"memory");
 #endif
-            if (1)
-            {
-                // Update LRU for least *frequently* used strategy
-                if (this->ln_Pred->ln_Pred) {
-                    struct Node *pred = this->ln_Pred;
-                    struct Node *succ = this->ln_Succ;
-
-                    this->ln_Pred = pred->ln_Pred;
-                    this->ln_Succ = pred;
-                    this->ln_Pred->ln_Succ = this;
-                    pred->ln_Pred = this;
-                    pred->ln_Succ = succ;
-                    succ->ln_Pred = pred;
-                }
-            }
-            else
-            {
-                // Update LRU for least *recently* used strategy
-                REMOVE(&unit->mt_LRUNode);
-                ADDHEAD(&LRU, &unit->mt_LRUNode);
-            }
+                /* Unit found? Mark it as referenced, so that it survives the nursery collection */
+                unit = (struct M68KTranslationUnit *)((uintptr_t)jit_tlsf + bucket->cb_Unit[i]);
 
-            return unit;
+                if (!unit->mt_Referenced)
+                    unit->mt_Referenced = 1;
+
+                return unit;
+            }
+            else if (bucket->cb_M68kPC[i] == ICACHE_EMPTY)
+                return NULL;
         }
     }
-
-    return NULL;
 }
 
 #endif /* _M68K_H */
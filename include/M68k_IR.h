@@ -0,0 +1,70 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _M68K_IR_H
+#define _M68K_IR_H
+
+#include <stdint.h>
+#include "M68k.h"
+
+/*
+    Micro-op form of straight-line AArch64 code emitted for consecutive m68k instructions. Every
+    op is one host instruction with its registers, flags and kind decoded, so that passes can
+    look at the whole block instead of one m68k instruction at a time. Code with branches,
+    PC-relative accesses or translator markers is never lifted, it ends the block.
+*/
+
+/* Kind of micro-op */
+#define IR_ALU          0   /* No side effects, removed if nothing it defines is used */
+#define IR_LOAD         1
+#define IR_STORE        2
+#define IR_SYS          3   /* System register write, hint or barrier */
+#define IR_OPAQUE       4   /* Not decoded, uses and defines everything */
+
+/* Register operand of a micro-op, pos is the bit position of the 5-bit field */
+#define IR_USE          0x01
+#define IR_DEF          0x02
+#define IR_SP           0x04    /* Register 31 is SP, otherwise it is ZR */
+#define IR_V            0x08    /* SIMD/FP register */
+#define IR_W64          0x10    /* All 64 bits are read */
+
+struct IROperand {
+    uint8_t     io_Pos;
+    uint8_t     io_Flags;
+};
+
+/* Flags of a micro-op */
+#define IRF_SETS_NZCV   0x01
+#define IRF_USES_NZCV   0x02
+#define IRF_DEAD        0x04
+#define IRF_WRITEBACK   0x08    /* Load or store updating its base register */
+
+#define IR_MAX_OPERANDS 4
+
+/* Registers in masks: x0-x30 in bits 0-30, SP in bit 31, v0-v31 in bits 32-63 */
+struct IROp {
+    uint32_t            op_Insn;        /* Host instruction, native byte order */
+    uint16_t            op_Index;       /* Index of the m68k instruction in local state */
+    uint8_t             op_Kind;
+    uint8_t             op_Flags;
+    uint64_t            op_Def;
+    uint64_t            op_Use;
+    uint8_t             op_OperandCount;
+    struct IROperand    op_Operands[IR_MAX_OPERANDS];
+};
+
+#define IR_MAX_OPS      4096
+
+void IR_Init();
+int IR_IsEmpty();
+int IR_Lift(uint32_t *start, uint32_t *end, uint16_t index);
+uint64_t IR_GetDefs(uint32_t *start, uint32_t *end);
+uint32_t *IR_Lower(uint32_t *arm_code, uint32_t *end, struct M68KLocalState *local_state, uint16_t live_temps);
+
+#endif /* _M68K_IR_H */
@@ -0,0 +1,47 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _M68K_SCAN_H
+#define _M68K_SCAN_H
+
+#include <stdint.h>
+
+/*
+    Code segment of an executable walked by the scanner. The contents may live at another
+    address than the one the m68k code sees, e.g. in the offline translation tool.
+*/
+struct ScanSegment {
+    uint32_t        ss_Address;     /* m68k address of the segment */
+    uint32_t        ss_Size;        /* Size in bytes */
+    uint16_t *      ss_Data;        /* Contents of the segment */
+    uint32_t *      ss_Seen;        /* One bit per 16-bit word, set for decoded opcodes */
+    uint32_t *      ss_Entry;       /* One bit per 16-bit word, set for entry points of units */
+    uint32_t        ss_Index;       /* Hunk number or ELF section index */
+};
+
+/* Size of the bitmaps of a segment in 32-bit words */
+#define SCAN_BITMAP_WORDS(size)     (((size) / 2 + 31) / 32)
+
+struct Scanner {
+    struct ScanSegment *    sc_Segments;
+    uint32_t                sc_SegmentCount;
+    uint32_t *              sc_Stack;       /* Entry points waiting to be decoded */
+    uint32_t                sc_StackSize;
+    uint32_t                sc_StackTop;
+    uint32_t                sc_Entries;
+    uint32_t                sc_Instructions;
+    uint32_t                sc_Dropped;     /* Entry points lost because the stack was full */
+};
+
+void Scan_Init(struct Scanner *sc, struct ScanSegment *segments, uint32_t count, uint32_t *stack, uint32_t stack_size);
+struct ScanSegment *Scan_FindSegment(struct Scanner *sc, uint32_t address);
+int Scan_AddEntry(struct Scanner *sc, uint32_t address);
+void Scan_Run(struct Scanner *sc);
+
+#endif /* _M68K_SCAN_H */
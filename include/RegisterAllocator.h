@@ -46,8 +46,10 @@ void RA_StoreDirtyFPURegs(uint32_t **arm_stream);
 
 uint8_t RA_GetCTX(uint32_t **ptr);
 void RA_FlushCTX(uint32_t **ptr);
+int RA_IsStateFlushed();
 int RA_IsCCLoaded();
 int RA_IsCCModified();
+void RA_GetModifiedState(uint8_t *regs);
 uint8_t RA_GetCC(uint32_t **ptr);
 uint8_t RA_ModifyCC(uint32_t **ptr);
 void RA_FlushCC(uint32_t **ptr);
@@ -61,4 +63,10 @@ uint8_t RA_ModifyFPSR(uint32_t **ptr);
 void RA_FlushFPSR(uint32_t **ptr);
 void RA_StoreFPSR(uint32_t **ptr);
 
+void RA_ResetKnownValues();
+void RA_SetKnownValue(uint8_t m68k_reg, uint32_t value);
+int RA_GetKnownValue(uint8_t m68k_reg, uint32_t *value);
+void RA_UseKnownValue(uint8_t m68k_reg);
+int RA_UpdateKnownValues(uint64_t host_defs, uint32_t insn);
+
 #endif /* _REGISTER_ALLOCATOR_H */
@@ -26,6 +26,26 @@
 #endif
 
 #define EMU68_ARM_CACHE_SIZE    (4*1024*1024)
+#define EMU68_JIT_NURSERY_SIZE      (4*1024*1024)
+#define EMU68_JIT_TENURED_SIZE      (5*1024*1024)
+#define EMU68_JIT_TENURED_REGIONS   4
+#define EMU68_JIT_MAX_UNITS         16384
+#define EMU68_JIT_TIER1_DEPTH       32
+#define EMU68_JIT_TIER_THRESHOLD    1000
+#define EMU68_JIT_WORKERS           1
+#define EMU68_JIT_SPEC_QUEUE        256
+#define EMU68_JIT_WORKER_STACK      (64*1024)
+#define EMU68_JIT_WRITE_PROTECT     1
+#define EMU68_JIT_WP_FAULTS         8
+#define EMU68_JIT_SUSPECT_EPOCHS    4
+#define EMU68_JIT_NATIVE_LOOPS      1
+#define EMU68_JIT_IR                1
+#define EMU68_JIT_KNOWN_VALUES      1
+#define EMU68_JIT_RETURN_STACK      1
+#define EMU68_JIT_POLICY            1
+#define EMU68_JIT_POLICY_REGIONS    1024
+#define EMU68_JIT_MIN_DEPTH         8
+#define EMU68_JIT_INLINE_LIMIT      4096
 #define EMU68_M68K_INSN_DEPTH   255
 #define EMU68_HOST_BIG_ENDIAN   1
 #define EMU68_HAS_SETEND        1
@@ -0,0 +1,34 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _FINGERPRINT_H
+#define _FINGERPRINT_H
+
+#include <stdint.h>
+
+/* Fingerprint of m68k code range, used to find out whether translated code is still valid */
+struct Fingerprint {
+    uint32_t    fp_Kind;
+    uint32_t    fp_Length;
+    uint32_t    fp_Hash[4];
+    void *      fp_Snapshot;
+};
+
+#define FP_MD5          0   /* MD5 sum of the range */
+#define FP_CRC32        1   /* CRC32 and CRC32C sums of the range, computed with ARMv8 CRC instructions */
+#define FP_SNAPSHOT     2   /* Copy of the range, compared word by word */
+
+void Fingerprint_Init(const char *args);
+const char *Fingerprint_Name();
+void Fingerprint_Calc(struct Fingerprint *fp, void *start, void *end);
+int Fingerprint_Check(struct Fingerprint *fp, void *start, void *end);
+void Fingerprint_Release(struct Fingerprint *fp);
+void Fingerprint_Benchmark();
+
+#endif /* _FINGERPRINT_H */
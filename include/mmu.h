@@ -15,5 +15,7 @@
 void mmu_init();
 uintptr_t mmu_virt2phys(uintptr_t addr);
 void mmu_map(uintptr_t phys, uintptr_t virt, uintptr_t length, uint32_t attr_low, uint32_t attr_high);
+int mmu_protect(uintptr_t virt, int read_only);
+int mmu_fault_retry(uintptr_t virt);
 
 #endif /* _MMU_H */
\ No newline at end of file
@@ -0,0 +1,33 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _POLICY_H
+#define _POLICY_H
+
+#include <stdint.h>
+
+/* Translation limits of an m68k code region, adjusted from the behavior of its units */
+struct PolicyRegion {
+    uint32_t    pr_Region;
+    uint16_t    pr_Depth;       /* Maximal number of m68k instructions in a unit */
+    uint16_t    pr_Inline;      /* Maximal distance of inlined BRA, BSR and JSR in bytes */
+};
+
+#define POLICY_REGION_SHIFT     12
+#define POLICY_EXPANSION        24  /* Host instructions per m68k instruction considered too many */
+
+void Policy_Init(const char *args);
+uint16_t Policy_GetDepth(uint16_t *pc, int tier);
+int Policy_CanInline(uint16_t *pc, int32_t distance);
+void Policy_UnitCreated(uint16_t *pc, uint32_t m68k_count, uint32_t arm_count);
+void Policy_UnitEvicted(uint16_t *pc);
+void Policy_UnitHot(uint16_t *pc, uint32_t exit_count);
+void Policy_DumpStats();
+
+#endif /* _POLICY_H */
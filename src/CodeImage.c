@@ -0,0 +1,397 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "config.h"
+#include "support.h"
+#include "tlsf.h"
+#include "devicetree.h"
+#include "M68k.h"
+#include "M68k_Scan.h"
+#include "CodeImage.h"
+
+/*
+    Translation of the executable loaded at boot before its code runs. Entry points of units are
+    taken from the code image appended to the executable by tools/aot. Without an image they
+    may be found by scanning the loaded code, if "pretranslate" is given in the boot arguments.
+    The image is only used if it was built from exactly the same executable, every unit created
+    here gets its own fingerprint as usual.
+*/
+static struct CodeImageHeader *Image;
+static void *ExecFile;
+static void *ExecSegList;
+
+#define SCAN_STACK      16384
+
+/*
+    Remember the executable and find the code image at the end of the initrd. For HUNK files the
+    segment list returned by LoadHunkFile has to be given. ELF files have to be attached before
+    they are loaded, the loader changes section headers in place, but their load addresses are
+    taken from there later.
+*/
+int CodeImage_Attach(void *file, void *file_end, void *seglist)
+{
+    uintptr_t size = (uintptr_t)file_end - (uintptr_t)file;
+    struct CodeImageTrailer *trailer = (void *)((uintptr_t)file_end - sizeof(struct CodeImageTrailer));
+    struct CodeImageHeader *header;
+    uint32_t offset;
+
+    ExecFile = file;
+    ExecSegList = seglist;
+
+    if (size < sizeof(struct CodeImageTrailer) + sizeof(struct CodeImageHeader) || BE32(trailer->ct_Magic) != CI_MAGIC)
+        return 0;
+
+    offset = BE32(trailer->ct_Offset);
+    header = (void *)((uintptr_t)file + offset);
+
+    if (offset > size - sizeof(struct CodeImageTrailer) - sizeof(struct CodeImageHeader) ||
+        BE32(header->ci_Magic) != CI_MAGIC || BE32(header->ci_Version) != CI_VERSION ||
+        BE32(header->ci_FileSize) > offset ||
+        BE32(header->ci_EntryCount) > (size - offset - sizeof(struct CodeImageHeader)) / sizeof(struct CodeImageEntry))
+    {
+        kprintf("[ICache] Code image is damaged or of unknown version\n");
+        return 0;
+    }
+
+    if (CodeImage_CRC32(file, BE32(header->ci_FileSize)) != BE32(header->ci_FileCRC))
+    {
+        kprintf("[ICache] Code image was built for another executable, ignoring it\n");
+        return 0;
+    }
+
+    Image = header;
+
+    kprintf("[ICache] Code image with %d entry points attached\n", BE32(header->ci_EntryCount));
+
+    return 1;
+}
+
+/* Fields of ELF headers, read through BE32 like everything else coming from the file */
+#define ELF_SHOFF(e)            BE32(*(uint32_t *)&(e)[0x20])
+#define ELF_SHENTSIZE(e)        BE16(*(uint16_t *)&(e)[0x2e])
+#define ELF_SHNUM(e)            BE16(*(uint16_t *)&(e)[0x30])
+#define ELF_SH(e, i)            (&(e)[ELF_SHOFF(e) + (i) * ELF_SHENTSIZE(e)])
+#define SH_TYPE(sh)             BE32(*(uint32_t *)&(sh)[0x04])
+#define SH_FLAGS(sh)            BE32(*(uint32_t *)&(sh)[0x08])
+#define SH_ADDR(sh)             BE32(*(uint32_t *)&(sh)[0x0c])
+#define SH_OFFSET(sh)           BE32(*(uint32_t *)&(sh)[0x10])
+#define SH_SIZE(sh)             BE32(*(uint32_t *)&(sh)[0x14])
+#define SH_LINK(sh)             BE32(*(uint32_t *)&(sh)[0x18])
+#define SH_INFO(sh)             BE32(*(uint32_t *)&(sh)[0x1c])
+#define SH_ENTSIZE(sh)          BE32(*(uint32_t *)&(sh)[0x24])
+
+#define SHT_RELA        4
+#define SHF_ALLOC       2
+#define SHF_EXECINSTR   4
+
+/* Address and size of the segment with given number, 0 if there is no such segment */
+static uintptr_t CodeImage_Segment(uint32_t index, uint32_t *size)
+{
+    if (ExecSegList)
+    {
+        uint32_t *next = ExecSegList;
+
+        while (index-- && next)
+            next = (uint32_t *)(uintptr_t)*next;
+
+        if (next && size)
+            *size = next[-1];
+
+        return next ? (uintptr_t)next + 4 : 0;
+    }
+    else
+    {
+        uint8_t *elf = ExecFile;
+
+        if (index >= ELF_SHNUM(elf) || !(SH_FLAGS(ELF_SH(elf, index)) & SHF_ALLOC))
+            return 0;
+
+        if (size)
+            *size = SH_SIZE(ELF_SH(elf, index));
+
+        /* sh_addr of the section, set to its load address by LoadELFFile */
+        return SH_ADDR(ELF_SH(elf, index));
+    }
+}
+
+/* Entry points of units listed in the code image */
+static uint16_t **CodeImage_Entries(uint32_t *count)
+{
+    struct CodeImageEntry *entry = (struct CodeImageEntry *)&Image[1];
+    uint16_t **list = tlsf_malloc(tlsf, BE32(Image->ci_EntryCount) * sizeof(uint16_t *));
+
+    *count = 0;
+    if (list == NULL)
+        return NULL;
+
+    for (uint32_t i=0; i < BE32(Image->ci_EntryCount); i++)
+    {
+        uintptr_t segment = CodeImage_Segment(BE32(entry[i].ce_Segment), NULL);
+
+        if (segment)
+            list[(*count)++] = (uint16_t *)(segment + BE32(entry[i].ce_Offset));
+    }
+
+    return list;
+}
+
+static struct ScanSegment *AddSegment(struct ScanSegment *segments, uint32_t *count, uint32_t index, uintptr_t address, uint32_t size)
+{
+    struct ScanSegment *s = &segments[(*count)++];
+
+    s->ss_Address = address;
+    s->ss_Size = size;
+    s->ss_Index = index;
+    s->ss_Data = (uint16_t *)address;
+    s->ss_Seen = tlsf_malloc(tlsf, 4 * SCAN_BITMAP_WORDS(size));
+    s->ss_Entry = tlsf_malloc(tlsf, 4 * SCAN_BITMAP_WORDS(size));
+
+    return s;
+}
+
+/*
+    Walk blocks of a HUNK file. In the first pass code hunks become segments of the scanner,
+    in the second one all pointers to code hunks stored in other hunks become entry points.
+*/
+static void ScanHunks(struct Scanner *sc, struct ScanSegment *segments, uint32_t *count, uint8_t *is_code, int pass)
+{
+    uint32_t *words = ExecFile;
+    uint32_t first = BE32(words[3]);
+    uint32_t last = BE32(words[4]);
+    uint32_t current = 0;
+
+    words += 5 + last - first + 1;
+
+    while (current <= last)
+    {
+        uint32_t h = current - first;
+
+        switch (BE32(*words))
+        {
+            case 0x3e9:
+            case 0x3ea:
+                if (pass == 0 && current >= first)
+                {
+                    uint32_t size = 0;
+                    uintptr_t address = CodeImage_Segment(h, &size);
+
+                    is_code[h] = BE32(*words) == 0x3e9;
+                    if (is_code[h] && address)
+                        AddSegment(segments, count, h, address, size);
+                }
+                words += 2 + BE32(words[1]);
+                break;
+
+            case 0x3eb:
+                words += 2;
+                break;
+
+            case 0x3ec:
+            case 0x3fd:
+            {
+                int absolute = BE32(*words) == 0x3ec;
+
+                words++;
+                while (BE32(words[0]) != 0)
+                {
+                    uint32_t n = BE32(words[0]);
+                    uint32_t ref = BE32(words[1]) - first;
+
+                    words += 2;
+
+                    if (pass == 1 && absolute && current >= first && !is_code[h] && ref <= last - first && is_code[ref])
+                    {
+                        uintptr_t base = CodeImage_Segment(h, NULL);
+
+                        for (uint32_t i=0; i < n; i++)
+                            Scan_AddEntry(sc, BE32(*(uint32_t *)(base + BE32(words[i]))));
+                    }
+                    words += n;
+                }
+                words++;
+                break;
+            }
+
+            case 0x3f0:
+                words++;
+                while (BE32(words[0]) != 0)
+                    words += BE32(words[0]) + 2;
+                words++;
+                break;
+
+            case 0x3f2:
+                words++;
+                current++;
+                break;
+
+            default:
+                words += 2 + BE32(words[1]);
+                break;
+        }
+    }
+}
+
+/*
+    Same for ELF files. Executable sections become segments, pointers to them stored in other
+    sections are found through the relocations.
+*/
+static void ScanELF(struct Scanner *sc, struct ScanSegment *segments, uint32_t *count, int pass)
+{
+    uint8_t *elf = ExecFile;
+
+    for (uint32_t i=0; i < ELF_SHNUM(elf); i++)
+    {
+        uint8_t *sh = ELF_SH(elf, i);
+
+        if (pass == 0)
+        {
+            if ((SH_FLAGS(sh) & (SHF_ALLOC | SHF_EXECINSTR)) == (SHF_ALLOC | SHF_EXECINSTR) && SH_SIZE(sh))
+                AddSegment(segments, count, i, SH_ADDR(sh), SH_SIZE(sh));
+        }
+        else if (SH_TYPE(sh) == SHT_RELA && SH_ENTSIZE(sh) && SH_INFO(sh) < ELF_SHNUM(elf))
+        {
+            uint8_t *target = ELF_SH(elf, SH_INFO(sh));
+            uint8_t *symtab = ELF_SH(elf, SH_LINK(sh));
+
+            if ((SH_FLAGS(target) & (SHF_ALLOC | SHF_EXECINSTR)) != SHF_ALLOC)
+                continue;
+
+            for (uint32_t r=0; r < SH_SIZE(sh) / SH_ENTSIZE(sh); r++)
+            {
+                uint8_t *rel = &elf[SH_OFFSET(sh) + r * SH_ENTSIZE(sh)];
+                uint32_t offset = BE32(*(uint32_t *)&rel[0]);
+                uint32_t info = BE32(*(uint32_t *)&rel[4]);
+                uint8_t *sym = &elf[SH_OFFSET(symtab) + (info >> 8) * 16];
+                uint16_t shndx = BE16(*(uint16_t *)&sym[14]);
+
+                /* R_68K_32 pointing to executable section */
+                if ((info & 0xff) == 1 && shndx < ELF_SHNUM(elf) && (SH_FLAGS(ELF_SH(elf, shndx)) & SHF_EXECINSTR))
+                    Scan_AddEntry(sc, BE32(*(uint32_t *)(uintptr_t)(SH_ADDR(target) + offset)));
+            }
+        }
+    }
+}
+
+/*
+    Find entry points of units by recursive descent through the loaded code, starting with the
+    entry point of the executable and all pointers to code found in its data.
+*/
+static uint16_t **CodeImage_Scan(uint16_t *entry, uint32_t *count)
+{
+    int is_hunk = BE32(*(uint32_t *)ExecFile) == 0x3f3;
+    uint32_t max = is_hunk ? BE32(((uint32_t *)ExecFile)[4]) - BE32(((uint32_t *)ExecFile)[3]) + 1 : ELF_SHNUM((uint8_t *)ExecFile);
+    struct ScanSegment *segments = tlsf_malloc(tlsf, max * sizeof(struct ScanSegment));
+    uint8_t *is_code = tlsf_malloc(tlsf, max);
+    uint32_t *stack = tlsf_malloc(tlsf, SCAN_STACK * sizeof(uint32_t));
+    uint32_t segment_count = 0;
+    uint16_t **list = NULL;
+    struct Scanner sc;
+
+    *count = 0;
+
+    if (segments == NULL || is_code == NULL || stack == NULL)
+        goto out;
+
+    if (is_hunk)
+        ScanHunks(NULL, segments, &segment_count, is_code, 0);
+    else
+        ScanELF(NULL, segments, &segment_count, 0);
+
+    for (uint32_t i=0; i < segment_count; i++)
+        if (segments[i].ss_Seen == NULL || segments[i].ss_Entry == NULL)
+            goto out;
+
+    Scan_Init(&sc, segments, segment_count, stack, SCAN_STACK);
+    Scan_AddEntry(&sc, (uint32_t)(uintptr_t)entry);
+
+    if (is_hunk)
+        ScanHunks(&sc, segments, &segment_count, is_code, 1);
+    else
+        ScanELF(&sc, segments, &segment_count, 1);
+
+    Scan_Run(&sc);
+
+    kprintf("[ICache] Scanned %d code segments, %d instructions, %d entry points\n",
+        segment_count, sc.sc_Instructions, sc.sc_Entries);
+
+    list = tlsf_malloc(tlsf, sc.sc_Entries * sizeof(uint16_t *));
+    if (list == NULL)
+        goto out;
+
+    for (uint32_t i=0; i < segment_count; i++)
+    {
+        struct ScanSegment *s = &segments[i];
+
+        for (uint32_t w=0; w < s->ss_Size / 2; w++)
+        {
+            if (s->ss_Entry[w >> 5] & (1U << (w & 31)))
+                list[(*count)++] = (uint16_t *)(uintptr_t)(s->ss_Address + 2 * w);
+        }
+    }
+
+out:
+    for (uint32_t i=0; i < segment_count; i++)
+    {
+        if (segments[i].ss_Seen)
+            tlsf_free(tlsf, segments[i].ss_Seen);
+        if (segments[i].ss_Entry)
+            tlsf_free(tlsf, segments[i].ss_Entry);
+    }
+    if (segments)
+        tlsf_free(tlsf, segments);
+    if (is_code)
+        tlsf_free(tlsf, is_code);
+    if (stack)
+        tlsf_free(tlsf, stack);
+
+    return list;
+}
+
+/*
+    Translate units of the executable before it starts. Has to be called after the cache is set
+    up and before the workers are started. With "pretranslate=background" the units are left to
+    the translation workers and the m68k code starts at once.
+*/
+void CodeImage_Preload(uint16_t *entry)
+{
+    of_node_t *chosen = dt_find_node("/chosen");
+    of_property_t *bootargs = chosen ? dt_find_property(chosen, "bootargs") : NULL;
+    const char *args = bootargs ? bootargs->op_value : "";
+    uint16_t **list = NULL;
+    uint32_t count = 0;
+    uint32_t created = 0;
+
+    if (ExecFile == NULL)
+        return;
+
+    if (Image)
+        list = CodeImage_Entries(&count);
+    else if (strstr(args, "pretranslate"))
+        list = CodeImage_Scan(entry, &count);
+
+    if (list == NULL)
+        return;
+
+    /* Leave room for the code found only at run time */
+    if (count > EMU68_JIT_MAX_UNITS / 2)
+        count = EMU68_JIT_MAX_UNITS / 2;
+
+    if (strstr(args, "pretranslate=background") && M68K_QueuePreload(list, count))
+    {
+        kprintf("[ICache] %d units left to translation workers\n", count);
+        return;
+    }
+
+    for (uint32_t i=0; i < count; i++)
+        created += M68K_PreloadUnit(list[i]);
+
+    tlsf_free(tlsf, list);
+
+    kprintf("[ICache] Preloaded %d units\n", created);
+}
@@ -9,6 +9,7 @@
 */
 
 #include "support.h"
+#include "config.h"
 #include "M68k.h"
 #include "RegisterAllocator.h"
 
@@ -511,6 +512,107 @@ static inline __attribute__((always_inline)) uint32_t * store_reg_to_addr(uint32
     return ptr;
 }
 
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+/* Offset which a single load, store or (for size 0) add of given size can apply to its base */
+static inline int known_single_offset(int64_t offset, uint8_t size)
+{
+    if (size == 0)
+        return offset > -4096 && offset < 4096;
+    if (offset > -256 && offset < 256)
+        return 1;
+
+    return offset >= 0 && offset < 4096 * size && (offset & (size - 1)) == 0;
+}
+
+/*
+    Find an m68k register with known value from which the absolute address in extension words
+    (long if abs_long is set) can be reached by a single load, store or add. Returns the ARM
+    register holding it, or 0xff if there is none.
+*/
+static uint8_t known_base(uint32_t **ptr, uint16_t *ext, uint8_t abs_long, uint8_t size, int32_t *offset)
+{
+    uint32_t address = (uint32_t)(int16_t)BE16(ext[0]);
+    uint32_t value;
+
+    if (abs_long)
+        address = ((uint32_t)BE16(ext[0]) << 16) | BE16(ext[1]);
+
+    for (uint8_t r=0; r < 16; r++)
+    {
+        if (RA_GetKnownValue(r, &value) && known_single_offset((int64_t)address - value, size))
+        {
+            RA_UseKnownValue(r);
+            *offset = (int64_t)address - value;
+            return RA_MapM68kRegister(ptr, r);
+        }
+    }
+
+    return 0xff;
+}
+
+/*
+    Fold a known index register of the brief extension word together with the displacement into
+    one offset from An, if a single load, store or add can apply it.
+*/
+static int known_index(uint16_t brief, uint8_t size, int32_t *offset)
+{
+    uint8_t reg = (brief >> 12) & 15;
+    uint32_t value;
+    int64_t off;
+
+    if (!RA_GetKnownValue(reg, &value))
+        return 0;
+
+    off = (brief & (1 << 11)) ? (int32_t)value : (int16_t)value;
+    off = off * (1 << ((brief >> 9) & 3)) + (int8_t)(brief & 0xff);
+
+    if (!known_single_offset(off, size))
+        return 0;
+
+    RA_UseKnownValue(reg);
+    *offset = off;
+
+    return 1;
+}
+
+/*
+    Compute the address of an EA at translation time, if it does not depend on run time state.
+    Used by LEA to make the loaded address register known.
+*/
+int M68K_GetKnownEA(uint8_t ea, uint16_t *m68k_ptr, uint32_t *address)
+{
+    uint8_t mode = ea >> 3;
+    uint8_t src_reg = ea & 7;
+    uint32_t value;
+
+    if ((mode == 2 || mode == 5) && RA_GetKnownValue(8 + src_reg, &value))
+    {
+        RA_UseKnownValue(8 + src_reg);
+        *address = value;
+        if (mode == 5)
+            *address += (int16_t)BE16(m68k_ptr[0]);
+        return 1;
+    }
+    else if (mode == 7 && src_reg == 0)
+    {
+        *address = (int16_t)BE16(m68k_ptr[0]);
+        return 1;
+    }
+    else if (mode == 7 && src_reg == 1)
+    {
+        *address = ((uint32_t)BE16(m68k_ptr[0]) << 16) | BE16(m68k_ptr[1]);
+        return 1;
+    }
+    else if (mode == 7 && src_reg == 2)
+    {
+        *address = (uint32_t)(uintptr_t)m68k_ptr + (int16_t)BE16(m68k_ptr[0]);
+        return 1;
+    }
+
+    return 0;
+}
+#endif
+
 #define M68K_EA_DA 0x8000
 #define M68K_EA_REG 0x7000
 #define M68K_EA_WL 0x0800
@@ -718,7 +820,18 @@ uint32_t *EMIT_LoadFromEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *ar
         {
             uint16_t brief = BE16(m68k_ptr[(*ext_words)++]);
             uint8_t extra_reg = (brief >> 12) & 7;
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            int32_t known_offset;
+
+            /* Index register known, address is An plus constant */
+            if ((brief & 0x0100) == 0 && known_index(brief, size, &known_offset))
+            {
+                uint8_t reg_An = RA_MapM68kRegister(&ptr, src_reg + 8);
 
+                ptr = load_reg_from_addr_offset(ptr, size, reg_An, *arm_reg, known_offset, 0);
+            }
+            else
+#endif
             if ((brief & 0x0100) == 0)
             {
                 uint8_t reg_An = RA_MapM68kRegister(&ptr, src_reg + 8);
@@ -944,6 +1057,11 @@ uint32_t *EMIT_LoadFromEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *ar
         }
         else if (mode == 7)
         {
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            uint8_t known_reg;
+            int32_t known_offset;
+#endif
+
             if (src_reg == 2) /* (d16, PC) mode */
             {
                 if (imm_offset && size == 0 && read_only)
@@ -1191,6 +1309,15 @@ uint32_t *EMIT_LoadFromEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *ar
                         RA_FreeARMRegister(&ptr, index_reg);
                 }
             }
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            /* Absolute address close to a known register value */
+            else if ((src_reg == 0 || src_reg == 1) &&
+                (known_reg = known_base(&ptr, &m68k_ptr[*ext_words], src_reg, size, &known_offset)) != 0xff)
+            {
+                (*ext_words) += src_reg + 1;
+                ptr = load_reg_from_addr_offset(ptr, size, known_reg, *arm_reg, known_offset, 0);
+            }
+#endif
             else if (src_reg == 0)
             {
                 uint16_t lo16;
@@ -1471,7 +1598,18 @@ uint32_t *EMIT_StoreToEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *arm
         {
             uint16_t brief = BE16(m68k_ptr[(*ext_words)++]);
             uint8_t extra_reg = (brief >> 12) & 7;
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            int32_t known_offset;
+
+            /* Index register known, address is An plus constant */
+            if ((brief & 0x0100) == 0 && known_index(brief, size, &known_offset))
+            {
+                uint8_t reg_An = RA_MapM68kRegister(&ptr, src_reg + 8);
 
+                ptr = store_reg_to_addr_offset(ptr, size, reg_An, *arm_reg, known_offset, 0);
+            }
+            else
+#endif
             if ((brief & 0x0100) == 0)
             {
                 uint8_t reg_An = RA_MapM68kRegister(&ptr, src_reg + 8);
@@ -1691,6 +1829,11 @@ uint32_t *EMIT_StoreToEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *arm
         }
         else if (mode == 7)
         {
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            uint8_t known_reg;
+            int32_t known_offset;
+#endif
+
             if (src_reg == 2) /* (d16, PC) mode */
             {
                 int8_t off = 2;
@@ -1927,6 +2070,15 @@ uint32_t *EMIT_StoreToEffectiveAddress(uint32_t *ptr, uint8_t size, uint8_t *arm
                         RA_FreeARMRegister(&ptr, index_reg);
                 }
             }
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+            /* Absolute address close to a known register value */
+            else if ((src_reg == 0 || src_reg == 1) &&
+                (known_reg = known_base(&ptr, &m68k_ptr[*ext_words], src_reg, size, &known_offset)) != 0xff)
+            {
+                (*ext_words) += src_reg + 1;
+                ptr = store_reg_to_addr_offset(ptr, size, known_reg, *arm_reg, known_offset, 0);
+            }
+#endif
             else if (src_reg == 0)
             {
                 uint16_t lo16;
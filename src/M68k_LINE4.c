@@ -8,8 +8,10 @@
 */
 
 #include "support.h"
+#include "config.h"
 #include "M68k.h"
 #include "RegisterAllocator.h"
+#include "policy.h"
 
 uint32_t *EMIT_MUL_DIV(uint32_t *ptr, uint16_t opcode, uint16_t **m68k_ptr);
 
@@ -1627,10 +1629,30 @@ uint32_t *EMIT_line4(uint32_t *ptr, uint16_t **m68k_ptr)
         uint16_t *ret_addr = M68K_PopReturnAddress(NULL);
         if (ret_addr != (uint16_t *)0xffffffff)
         {
+#ifdef __aarch64__
+            /* Return address on the stack may have been changed, leave the unit if it differs */
+            uint32_t *tmpptr;
+
+            ptr = EMIT_PopReturnStack(ptr);
+            *ptr++ = movw_immed_u16(tmp, (uintptr_t)ret_addr & 0xffff);
+            if (((uintptr_t)ret_addr >> 16) & 0xffff)
+                *ptr++ = movt_immed_u16(tmp, ((uintptr_t)ret_addr >> 16) & 0xffff);
+            *ptr++ = cmp_reg(REG_PC, tmp, LSL, 0);
+            tmpptr = ptr;
+            *ptr++ = b_cc(A64_CC_EQ, 1);
+
+            *ptr++ = (uint32_t)(uintptr_t)tmpptr;
+            *ptr++ = 1;
+            *ptr++ = 0;
+            *ptr++ = INSN_TO_LE(0xfffffffe);
+#endif
             *m68k_ptr = ret_addr;
         }
         else
+        {
+            *ptr++ = INSN_TO_LE(0xfffffffb);
             *ptr++ = INSN_TO_LE(0xffffffff);
+        }
         RA_FreeARMRegister(&ptr, tmp);
     }
     /* 0100111001110110 - TRAPV */
@@ -1797,6 +1819,13 @@ uint32_t *EMIT_line4(uint32_t *ptr, uint16_t **m68k_ptr)
         uint8_t ext_words = 0;
         uint8_t ea = 0xff;
         uint8_t sp = 0xff;
+        int known_target = 0;
+        uint32_t target = 0;
+
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+        /* Target of abs.w, abs.l, (d16,PC) and of (An) or (d16,An) with a known An is constant */
+        known_target = M68K_GetKnownEA(opcode & 0x3f, *m68k_ptr, &target);
+#endif
 
         sp = RA_MapM68kRegister(&ptr, 15);
         ptr = EMIT_LoadFromEffectiveAddress(ptr, 0, &ea, opcode & 0x3f, (*m68k_ptr), &ext_words, 1, NULL);
@@ -1808,7 +1837,30 @@ uint32_t *EMIT_line4(uint32_t *ptr, uint16_t **m68k_ptr)
         *ptr++ = mov_reg(REG_PC, ea);
         (*m68k_ptr) += ext_words;
         RA_FreeARMRegister(&ptr, ea);
-        *ptr++ = INSN_TO_LE(0xffffffff);
+
+        /*
+            Constant target close enough is inlined like BSR. The matching RTS compares the return
+            address with the one pushed here and leaves the unit if they differ. The return address
+            stack gets its entry anyway, the RTS may end up in another unit.
+        */
+        ptr = EMIT_PushReturnStack(ptr, *m68k_ptr);
+        if (known_target && Policy_CanInline(*m68k_ptr, (int32_t)(target - (uint32_t)(uintptr_t)*m68k_ptr)))
+        {
+            M68K_PushReturnAddress(*m68k_ptr);
+            *m68k_ptr = (uint16_t *)(uintptr_t)target;
+        }
+        else if (known_target)
+        {
+            /* Target of the jump is known, mark it for chaining with next unit */
+            *ptr++ = target;
+            *ptr++ = INSN_TO_LE(0xfffffffd);
+            *ptr++ = INSN_TO_LE(0xffffffff);
+        }
+        else
+        {
+            *ptr++ = INSN_TO_LE(0xfffffffc);
+            *ptr++ = INSN_TO_LE(0xffffffff);
+        }
     }
     /* 0100111011xxxxxx - JMP */
     else if ((opcode & 0xffc0) == 0x4ec0)
@@ -1821,6 +1873,7 @@ uint32_t *EMIT_line4(uint32_t *ptr, uint16_t **m68k_ptr)
         *ptr++ = mov_reg(REG_PC, ea);
         (*m68k_ptr) += ext_words;
         RA_FreeARMRegister(&ptr, ea);
+        *ptr++ = INSN_TO_LE(0xfffffffc);
         *ptr++ = INSN_TO_LE(0xffffffff);
     }
     /* 01001x001xxxxxxx - MOVEM */
@@ -2062,6 +2115,14 @@ uint32_t *EMIT_line4(uint32_t *ptr, uint16_t **m68k_ptr)
         /* On AArch64 we can always map destination reg for write - it is always there! */
         dest = RA_MapM68kRegisterForWrite(&ptr, 8 + ((opcode >> 9) & 7));
         ptr = EMIT_LoadFromEffectiveAddress(ptr, 0, &dest, opcode & 0x3f, (*m68k_ptr), &ext_words, 1, NULL);
+#if EMU68_JIT_KNOWN_VALUES
+        {
+            uint32_t address;
+
+            if (M68K_GetKnownEA(opcode & 0x3f, *m68k_ptr, &address))
+                RA_SetKnownValue(8 + ((opcode >> 9) & 7), address);
+        }
+#endif
 #else
         ptr = EMIT_LoadFromEffectiveAddress(ptr, 0, &ea, opcode & 0x3f, (*m68k_ptr), &ext_words, 1, NULL);
         dest = RA_MapM68kRegisterForWrite(&ptr, 8 + ((opcode >> 9) & 7));
@@ -117,7 +117,8 @@ uint32_t *EMIT_line5(uint32_t *ptr, uint16_t **m68k_ptr)
                 
                 *ptr++ = (uint32_t)(uintptr_t)branch_2;
                 *ptr++ = branch_1 == NULL ? 1 : 2;
-                *ptr++ = 0;
+                /* Side exit continues the loop, its target is known at translation time */
+                *ptr++ = (uint32_t)(uintptr_t)*m68k_ptr - 2 + (int16_t)BE16((*m68k_ptr)[-1]);
                 *ptr++ = INSN_TO_LE(0xfffffffe);
 
                 RA_FreeARMRegister(&ptr, counter_reg);
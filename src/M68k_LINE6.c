@@ -10,6 +10,7 @@
 #include "support.h"
 #include "M68k.h"
 #include "RegisterAllocator.h"
+#include "policy.h"
 
 uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
 {
@@ -119,8 +120,12 @@ uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
 #endif
         RA_FreeARMRegister(&ptr, reg);
 
-        /* If branch is done within +- 4KB, try to inline it instead of breaking up the translation unit */
-        if (bra_off >= -4096 && bra_off <= 4096) {
+        /* Return address stack gets the entry also for an inlined call, its RTS may be in another unit */
+        if (bsr)
+            ptr = EMIT_PushReturnStack(ptr, *m68k_ptr);
+
+        /* If branch is short enough, try to inline it instead of breaking up the translation unit */
+        if (Policy_CanInline(bra_rel_ptr, bra_off)) {
             if (bsr) {
                 M68K_PushReturnAddress(*m68k_ptr);
             }
@@ -128,7 +133,12 @@ uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
             *m68k_ptr = (void *)((uintptr_t)bra_rel_ptr + bra_off);
         }
         else
+        {
+            /* Target of the branch is known, mark it for chaining with next unit */
+            *ptr++ = (uint32_t)((uintptr_t)bra_rel_ptr + bra_off);
+            *ptr++ = INSN_TO_LE(0xfffffffd);
             *ptr++ = INSN_TO_LE(0xffffffff);
+        }
     }
     /* 0110ccccxxxxxxxx - Bcc */
     else
@@ -136,6 +146,7 @@ uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
         uint32_t *tmpptr;
         uint8_t m68k_condition = (opcode >> 8) & 15;
         uint8_t success_condition = 0;
+        int follow_taken = 1;
 
         success_condition = EMIT_TestCondition(&ptr, m68k_condition);
 
@@ -237,8 +248,16 @@ uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
         *ptr++ = csel(REG_PC, pc_yes, pc_no, success_condition);
         RA_FreeARMRegister(&ptr, pc_yes);
         RA_FreeARMRegister(&ptr, pc_no);
+
+        /* Profile says the branch is mostly not taken, continue on the fall-through path */
+        if (M68K_IsFallThroughHot(*m68k_ptr))
+            follow_taken = 0;
+
         tmpptr = ptr;
-        *ptr++ = b_cc(success_condition, 1);
+        if (follow_taken)
+            *ptr++ = b_cc(success_condition, 1);
+        else
+            *ptr++ = b_cc(success_condition ^ 1, 1);
 #else
         if (local_pc_off_16 > 0 && local_pc_off_16 < 255)
             *ptr++ = add_immed(REG_PC, REG_PC, local_pc_off_16);
@@ -254,12 +273,17 @@ uint32_t *EMIT_line6(uint32_t *ptr, uint16_t **m68k_ptr)
         *tmpptr = b_cc(success_condition, ptr-tmpptr-2);
 #endif
 
-        *m68k_ptr = (uint16_t *)branch_target;
+        /* Side exit leaves the unit on the path which is not followed */
+        intptr_t side_exit = (intptr_t)(*m68k_ptr);
+        if (follow_taken)
+            *m68k_ptr = (uint16_t *)branch_target;
+        else
+            side_exit = branch_target;
 
         RA_FreeARMRegister(&ptr, reg);
         *ptr++ = (uint32_t)(uintptr_t)tmpptr;
         *ptr++ = 1;
-        *ptr++ = branch_target;
+        *ptr++ = side_exit;
         *ptr++ = INSN_TO_LE(0xfffffffe);
     }
 
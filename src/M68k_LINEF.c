@@ -1858,10 +1858,6 @@ void *invalidate_instruction_cache(uintptr_t target_addr, uint16_t *pc, uint32_t
 {
     int i;
     uint16_t opcode = BE16(pc[0]);
-    struct M68KTranslationUnit *u;
-    struct Node *n, *next;
-    extern struct List LRU;
-    extern void *jit_tlsf;
     #ifndef __aarch64__
     extern uint32_t last_PC;
     #endif
@@ -1886,55 +1882,26 @@ void *invalidate_instruction_cache(uintptr_t target_addr, uint16_t *pc, uint32_t
     last_PC = 0xffffffff;
     #endif
 
+    M68K_LockCache();
+
     /* Get the scope */
     switch (opcode & 0x18) {
         case 0x08:  /* Line */
             // kprintf("[LINEF] Invalidating line\n");
-            ForeachNodeSafe(&LRU, n, next)
-            {
-                u = (struct M68KTranslationUnit *)((intptr_t)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode));
-
-                // If highest address of unit is lower than the begin flushed area, or lowest address of unit higher than the flushed area end
-                // then skip the unit
-                if ((uintptr_t)u->mt_M68kLow > ((target_addr + 16) & ~15) || (uintptr_t)u->mt_M68kHigh < (target_addr & ~15))
-                    continue;
-
-                // kprintf("[LINEF] Unit %p, %08x-%08x match! Removing.\n", u, u->mt_M68kLow, u->mt_M68kHigh);
-
-                REMOVE(&u->mt_LRUNode);
-                REMOVE(&u->mt_HashNode);
-                tlsf_free(jit_tlsf, u);
-            }
+            M68K_FreeRange(target_addr & ~15, (target_addr & ~15) + 16);
             break;
         case 0x10:  /* Page */
             // kprintf("[LINEF] Invalidating page\n");
-            ForeachNodeSafe(&LRU, n, next)
-            {
-                u = (struct M68KTranslationUnit *)((intptr_t)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode));
-
-                // If highest address of unit is lower than the begin flushed area, or lowest address of unit higher than the flushed area end
-                // then skip the unit
-                if ((uintptr_t)u->mt_M68kLow > ((target_addr + 4096) & ~4095) || (uintptr_t)u->mt_M68kHigh < (target_addr & ~4095))
-                    continue;
-
-                // kprintf("[LINEF] Unit %p, %08x-%08x match! Removing.\n", u, u->mt_M68kLow, u->mt_M68kHigh);
-
-                REMOVE(&u->mt_LRUNode);
-                REMOVE(&u->mt_HashNode);
-                tlsf_free(jit_tlsf, u);
-            }
+            M68K_FreeRange(target_addr & ~4095, (target_addr & ~4095) + 4096);
             break;
         case 0x18:  /* All */
             // kprintf("[LINEF] Invalidating all\n");
-            while ((n = REMHEAD(&LRU))) {
-                u = (struct M68KTranslationUnit *)((intptr_t)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode));
-                // kprintf("[LINEF] Removing unit %p\n", u);                
-                REMOVE(&u->mt_HashNode);
-                tlsf_free(jit_tlsf, u);
-            }
+            M68K_InvalidateAll();
             break;
     }
 
+    M68K_UnlockCache();
+
     return &icache_epilogue[0];
 }
 
@@ -2819,12 +2786,14 @@ uint32_t *EMIT_lineF(uint32_t *ptr, uint16_t **m68k_ptr)
         *tmpptr = b_cc(success_condition, ptr-tmpptr-2);
 #endif
 
+        /* Side exit leaves the unit when branch is not taken */
+        intptr_t side_exit = (intptr_t)(*m68k_ptr);
         *m68k_ptr = (uint16_t *)branch_target;
 
         RA_FreeARMRegister(&ptr, reg);
         *ptr++ = (uint32_t)(uintptr_t)tmpptr;
         *ptr++ = 1;
-        *ptr++ = branch_target;
+        *ptr++ = side_exit;
         *ptr++ = INSN_TO_LE(0xfffffffe);
     }
     /* FCMP */
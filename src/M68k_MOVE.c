@@ -8,6 +8,7 @@
 */
 
 #include "support.h"
+#include "config.h"
 #include "M68k.h"
 #include "RegisterAllocator.h"
 
@@ -22,6 +23,9 @@ uint32_t *EMIT_moveq(uint32_t *ptr, uint16_t **m68k_ptr)
 
     *ptr++ = mov_immed_s8(tmp_reg, value);
     ptr = EMIT_AdvancePC(ptr, 2);
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+    RA_SetKnownValue(reg, value);
+#endif
 
     uint8_t mask = M68K_GetSRMask(*m68k_ptr);
     uint8_t update_mask = (SR_C | SR_V | SR_Z | SR_N) & ~mask;
@@ -135,6 +139,16 @@ uint32_t *EMIT_move(uint32_t *ptr, uint16_t **m68k_ptr)
 
     (*m68k_ptr) += ext_count;
 
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+    /* MOVE.L #imm,Dn and MOVEA #imm,An set a value known at translation time */
+    if (is_load_immediate && size == 4 && (tmp & 0x30) == 0)
+    {
+        if (is_movea && (opcode & 0x3000) == 0x3000)
+            immediate_value = (int16_t)immediate_value;
+        RA_SetKnownValue(tmp & 15, immediate_value);
+    }
+#endif
+
     if (!is_movea)
     {
         uint8_t mask = M68K_GetSRMask(*m68k_ptr);
@@ -1418,7 +1418,7 @@ int M68K_GetMoveLength(uint16_t *insn_stream)
 /* Get number of 16-bit words this instruction occupies */
 int M68K_GetINSNLength(uint16_t *insn_stream)
 {
-    uint16_t opcode = *insn_stream;
+    uint16_t opcode = BE16(*insn_stream);
     int length = 0;
 
 //    kprintf("[SR] M68K_GetINSNLength() addr=%08x opcode=%04x", insn_stream, BE16(*insn_stream));
@@ -0,0 +1,173 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "support.h"
+#include "M68k.h"
+#include "M68k_Scan.h"
+
+/*
+    Recursive descent through m68k code. Starting with known entry points, instructions are
+    decoded with the same length tables the translator uses. Targets of branches and calls, and
+    the instructions following conditional branches, calls and other instructions which end
+    a translation unit, become entry points of units. The scanner allocates no memory, all
+    bitmaps and the stack are given by the caller.
+*/
+
+void Scan_Init(struct Scanner *sc, struct ScanSegment *segments, uint32_t count, uint32_t *stack, uint32_t stack_size)
+{
+    sc->sc_Segments = segments;
+    sc->sc_SegmentCount = count;
+    sc->sc_Stack = stack;
+    sc->sc_StackSize = stack_size;
+    sc->sc_StackTop = 0;
+    sc->sc_Entries = 0;
+    sc->sc_Instructions = 0;
+    sc->sc_Dropped = 0;
+
+    for (uint32_t i=0; i < count; i++)
+    {
+        bzero(segments[i].ss_Seen, 4 * SCAN_BITMAP_WORDS(segments[i].ss_Size));
+        bzero(segments[i].ss_Entry, 4 * SCAN_BITMAP_WORDS(segments[i].ss_Size));
+    }
+}
+
+struct ScanSegment *Scan_FindSegment(struct Scanner *sc, uint32_t address)
+{
+    for (uint32_t i=0; i < sc->sc_SegmentCount; i++)
+    {
+        struct ScanSegment *s = &sc->sc_Segments[i];
+
+        if (address >= s->ss_Address && address - s->ss_Address < s->ss_Size)
+            return s;
+    }
+
+    return NULL;
+}
+
+/* Mark an entry point. Returns non-zero if it is new and lies within one of the segments */
+int Scan_AddEntry(struct Scanner *sc, uint32_t address)
+{
+    struct ScanSegment *s = Scan_FindSegment(sc, address);
+    uint32_t word;
+
+    if (s == NULL || (address & 1))
+        return 0;
+
+    word = (address - s->ss_Address) >> 1;
+    if (s->ss_Entry[word >> 5] & (1U << (word & 31)))
+        return 0;
+
+    s->ss_Entry[word >> 5] |= 1U << (word & 31);
+    sc->sc_Entries++;
+
+    if (sc->sc_StackTop < sc->sc_StackSize)
+        sc->sc_Stack[sc->sc_StackTop++] = address;
+    else
+        sc->sc_Dropped++;
+
+    return 1;
+}
+
+/* Target of JSR or JMP if it is known without running the code, 0 otherwise */
+static uint32_t Scan_JumpTarget(uint16_t *insn, uint32_t address)
+{
+    switch (BE16(insn[0]) & 0x3f)
+    {
+        case 0x38:  /* abs.w */
+            return (uint32_t)(int32_t)(int16_t)BE16(insn[1]);
+        case 0x39:  /* abs.l */
+            return ((uint32_t)BE16(insn[1]) << 16) | BE16(insn[2]);
+        case 0x3a:  /* (d16, PC) */
+            return address + 2 + (int16_t)BE16(insn[1]);
+        default:
+            return 0;
+    }
+}
+
+/* Decode code starting at given address until the flow of instructions ends */
+static void Scan_Walk(struct Scanner *sc, uint32_t address)
+{
+    struct ScanSegment *s = Scan_FindSegment(sc, address);
+
+    while (s != NULL && address - s->ss_Address + 2 <= s->ss_Size)
+    {
+        uint32_t word = (address - s->ss_Address) >> 1;
+        uint16_t *insn = &s->ss_Data[word];
+        uint16_t opcode;
+        uint32_t next;
+        int len;
+
+        if (s->ss_Seen[word >> 5] & (1U << (word & 31)))
+            return;
+
+        s->ss_Seen[word >> 5] |= 1U << (word & 31);
+
+        len = M68K_GetINSNLength(insn);
+        if (len == 0 || address - s->ss_Address + 2 * len > s->ss_Size)
+            return;
+
+        sc->sc_Instructions++;
+        next = address + 2 * len;
+
+        if (!M68K_IsBranch(insn))
+        {
+            address = next;
+            continue;
+        }
+
+        opcode = BE16(insn[0]);
+
+        /* Bcc, BRA, BSR */
+        if ((opcode & 0xf000) == 0x6000)
+        {
+            int32_t disp = (int8_t)(opcode & 0xff);
+
+            if (disp == 0)
+                disp = (int16_t)BE16(insn[1]);
+            else if (disp == -1)
+                disp = (int32_t)(((uint32_t)BE16(insn[1]) << 16) | BE16(insn[2]));
+
+            Scan_AddEntry(sc, address + 2 + disp);
+            if ((opcode & 0x0f00) != 0x0000)
+                Scan_AddEntry(sc, next);
+        }
+        /* DBcc */
+        else if ((opcode & 0xf0f8) == 0x50c8)
+        {
+            Scan_AddEntry(sc, address + 2 + (int16_t)BE16(insn[1]));
+            Scan_AddEntry(sc, next);
+        }
+        /* JSR, JMP */
+        else if ((opcode & 0xff80) == 0x4e80)
+        {
+            uint32_t target = Scan_JumpTarget(insn, address);
+
+            if (target)
+                Scan_AddEntry(sc, target);
+            if (!(opcode & 0x40))
+                Scan_AddEntry(sc, next);
+        }
+        /*
+            TRAP, moves to SR and other instructions ending a unit continue with the next one.
+            After RTE, RTD, RTS, RTR, STOP and ILLEGAL there is no way to know where the code
+            goes on.
+        */
+        else if (!(opcode == 0x4e73 || opcode == 0x4e74 || opcode == 0x4e75 || opcode == 0x4e77 ||
+                   opcode == 0x4e72 || opcode == 0x4afc))
+            Scan_AddEntry(sc, next);
+
+        return;
+    }
+}
+
+void Scan_Run(struct Scanner *sc)
+{
+    while (sc->sc_StackTop > 0)
+        Scan_Walk(sc, sc->sc_Stack[--sc->sc_StackTop]);
+}
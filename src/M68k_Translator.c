@@ -15,8 +15,12 @@
 #include "RegisterAllocator.h"
 #include "lists.h"
 #include "tlsf.h"
+#include "mmu.h"
+#include "devicetree.h"
 #include "config.h"
 #include "DuffCopy.h"
+#include "policy.h"
+#include "M68k_IR.h"
 
 
 #if SET_FEATURES_AT_RUNTIME
@@ -33,20 +37,128 @@ options_t Options = {
 const int debug = 0;
 const int debug_cnt = 0;
 
-struct List *ICache;
+struct M68KICacheBucket *ICache;
+uint32_t ICacheMask;
+static uint32_t ICacheUnits;
+struct M68KJumpCacheEntry *JumpCache;
+extern struct M68KState *__m68k_state;
 struct List LRU;
+static uint32_t cache_translations;
+static uint32_t cache_promotions;
+static uint32_t cache_evictions;
+static uint32_t cache_collections;
+static uint32_t cache_tierups;
+static uint32_t cache_speculations;
+static uint32_t cache_smc;
+static uint32_t cache_revivals;
+static uint32_t cache_stale;
+
+/* Number of full flushes of the cache, suspect units are dropped once they get too old */
+static uint32_t FlushEpoch;
+
+/*
+    Cache lock. Translator keeps its state in globals, so only one core may translate or
+    modify the cache at a time. ExecutionLoop reads the hash table without taking the lock.
+*/
+static volatile uint32_t CacheLock;
+
+/* Addresses queued for speculative translation by the workers */
+static uint16_t *SpecQueue[EMU68_JIT_SPEC_QUEUE];
+static uint32_t SpecHead;
+static uint32_t SpecTail;
+
+/* Units created by workers, their pending incoming exits are chained by the main core */
+static uint32_t DeferredLinks[EMU68_JIT_SPEC_QUEUE];
+static uint16_t *DeferredAddress[EMU68_JIT_SPEC_QUEUE];
+static uint32_t DeferredCount;
+
+/* Entry points found at boot, translated by the workers when there is nothing else to do */
+static uint16_t **PreloadList;
+static uint32_t PreloadCount;
+static uint32_t PreloadNext;
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+/*
+    Pages of m68k memory made read-only because they hold translated code, one bit per 4K page.
+    Pages which get written over and over again are left writable, they are tracked in a small
+    table of fault counters indexed by page number.
+*/
+static uint32_t *ProtectedPages;
+static uint8_t PageFaults[4096];
+#endif
+
+/*
+    Code cache regions. Units are bump allocated in the nursery. Once it is full, units which
+    were referenced since they were created are copied to the current tenured region and the
+    nursery is reclaimed as a whole. Tenured regions form a ring, the oldest one is reclaimed
+    as a whole when the current one cannot take more units.
+*/
+struct M68KCodeRegion {
+    uintptr_t       cr_Base;
+    uintptr_t       cr_Top;
+    uintptr_t       cr_End;
+};
+
+static struct M68KCodeRegion Nursery;
+static struct M68KCodeRegion Tenured[EMU68_JIT_TENURED_REGIONS];
+static uint32_t TenuredCurrent;
+
+/* Descriptors of all translation units, unused ones are kept on FreeUnits list */
+static struct M68KTranslationUnit *Units;
+static struct List FreeUnits;
+/* Units removed while they could still run, released once the main core is back in ExecutionLoop */
+static struct List RetiredUnits;
 static uint32_t *temporary_arm_code;
 static struct M68KLocalState *local_state;
 
+/* Exits of all units whose target is not in the cache yet, hashed by m68k target address */
+#define EXIT_HASH_SIZE  4096
+#define EXIT_HASH(ptr)  ((((uintptr_t)(ptr) >> 1) ^ ((uintptr_t)(ptr) >> 13)) & (EXIT_HASH_SIZE - 1))
+static struct List *PendingExits;
+
+/* Links of empty inline cache slots */
+static struct List IdleExits;
+
+/*
+    Page index of units, hashed by number of the 4K page of m68k memory. Units spanning more
+    than PAGE_SPAN pages have a single link on the WideUnits list, which is checked on every
+    lookup.
+*/
+#define PAGE_HASH_SIZE  4096
+#define PAGE_HASH(page) ((page) & (PAGE_HASH_SIZE - 1))
+#define PAGE_SPAN       8
+static struct List *PageUnits;
+static struct List WideUnits;
+
+/* Chainable exits of the unit being translated */
+#define MAX_EXITS       (EMU68_M68K_INSN_DEPTH + 1 + IBTC_SLOTS)
+static uint32_t exit_offset[MAX_EXITS];
+static uint16_t *exit_target[MAX_EXITS];
+static uint32_t exit_type[MAX_EXITS];
+static uint32_t exit_count;
+static uint32_t indirect_header;
+static uint32_t tier_literal;
+
+/* Fall-through paths of conditional branches found hot while the unit was running at tier 1 */
+static uint16_t *hot_fallthrough[MAX_EXITS];
+static uint32_t hot_fallthrough_count;
+
 int32_t _pc_rel = 0;
 
+/*
+    REG_PC is materialized lazily. Advancing the PC only changes _pc_rel, the register is
+    updated when an instruction reads the PC through EMIT_GetOffsetPC and the offset does not
+    fit, when it is flushed at exits, or when _pc_rel would not fit into a single add.
+*/
+#define PC_REL_MAX  4095
+
 uint32_t *EMIT_GetOffsetPC(uint32_t *ptr, int8_t *offset)
 {
     // Calculate new PC relative offset
     int new_offset = _pc_rel + *offset;
 
     // If overflow would occur then compute PC and get new offset
-    while (new_offset > 127 || new_offset < -127)
+    if (new_offset > 127 || new_offset < -127)
     {
         if (_pc_rel > 0)
             *ptr++ = add_immed(REG_PC, REG_PC, _pc_rel);
@@ -54,6 +166,7 @@ uint32_t *EMIT_GetOffsetPC(uint32_t *ptr, int8_t *offset)
             *ptr++ = sub_immed(REG_PC, REG_PC, -_pc_rel);
 
         _pc_rel = 0;
+        new_offset = *offset;
     }
 
     *offset = new_offset;
@@ -64,11 +177,8 @@ uint32_t *EMIT_GetOffsetPC(uint32_t *ptr, int8_t *offset)
 uint32_t *EMIT_AdvancePC(uint32_t *ptr, uint8_t offset)
 {
 //if (debug)    kprintf("Emit_AdvancePC(pc_rel=%d, off=%d)\n", _pc_rel, (int)offset);
-    // Calculate new PC relative offset
-    _pc_rel += (int)offset;
-
-    // If overflow would occur then compute PC and get new offset
-    if (_pc_rel > 120 || _pc_rel < -120)
+    // If overflow would occur then compute PC first
+    if (_pc_rel + (int)offset > PC_REL_MAX || _pc_rel < -PC_REL_MAX)
     {
         if (_pc_rel > 0)
             *ptr++ = add_immed(REG_PC, REG_PC, _pc_rel);
@@ -78,6 +188,9 @@ uint32_t *EMIT_AdvancePC(uint32_t *ptr, uint8_t offset)
         _pc_rel = 0;
     }
 
+    // Calculate new PC relative offset
+    _pc_rel += (int)offset;
+
     return ptr;
 }
 
@@ -168,6 +281,279 @@ void __clear_cache(void *begin, void *end)
     arm_icache_invalidate((uintptr_t)begin, (uintptr_t)end - (uintptr_t)begin);
 }
 
+#ifdef __aarch64__
+/*
+    Emit the chainable part of an exit with m68k target known at translation time. All
+    temporary registers are dead here. If no interrupt is pending and the instruction cache
+    is enabled, the patchable slot either returns to ExecutionLoop (unlinked exit) or
+    branches directly to the entry of the target unit. The caller emits the final return.
+*/
+static uint32_t *EMIT_ChainableExit(uint32_t *ptr, uint32_t *arm_code, uint16_t *target)
+{
+    if (target == NULL || exit_count >= MAX_EXITS)
+        return ptr;
+
+    *ptr++ = mrs(0, 3, 3, 13, 0, 3);
+    *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KState, PINT));
+#if EMU68_JIT_WRITE_PROTECT
+    /* Writes to translated code are caught by the MMU, exits may be chained with cache disabled */
+    *ptr++ = cbnz(1, 2);
+#else
+    *ptr++ = ldr_offset(0, 0, __builtin_offsetof(struct M68KState, CACR));
+    *ptr++ = cbnz(1, 3);
+    *ptr++ = tbz(0, CACRB_IE, 2);
+#endif
+
+    exit_offset[exit_count] = ptr - arm_code;
+    exit_target[exit_count] = target;
+    exit_type[exit_count] = EXIT_DIRECT;
+    exit_count++;
+
+    *ptr++ = bx_lr();
+
+    return ptr;
+}
+
+#if EMU68_JIT_NATIVE_LOOPS
+/*
+    Emit back-edge of a loop contained in the unit. Caller stores the cached state first, the
+    loop head is translated with nothing cached. Unless an interrupt is pending (or the
+    instruction cache is disabled) PC offset is changed to the one the head was translated
+    with and the code branches back to the head. Otherwise it falls through with PC untouched,
+    the caller emits an exit to ExecutionLoop there.
+*/
+static uint32_t *EMIT_LoopBackEdge(uint32_t *ptr, uint32_t *arm_code, struct M68KLocalState *head)
+{
+    int32_t delta = _pc_rel - head->mls_PCRel;
+    int skip = delta ? 3 : 2;
+
+    *ptr++ = mrs(0, 3, 3, 13, 0, 3);
+    *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KState, PINT));
+#if EMU68_JIT_WRITE_PROTECT
+    *ptr++ = cbnz(1, skip);
+#else
+    *ptr++ = ldr_offset(0, 0, __builtin_offsetof(struct M68KState, CACR));
+    *ptr++ = cbnz(1, skip + 1);
+    *ptr++ = tbz(0, CACRB_IE, skip);
+#endif
+    if (delta > 0)
+        *ptr++ = add_immed(REG_PC, REG_PC, delta);
+    else if (delta < 0)
+        *ptr++ = sub_immed(REG_PC, REG_PC, -delta);
+    *ptr = b(&arm_code[head->mls_ARMOffset] - ptr);
+    ptr++;
+
+    return ptr;
+}
+#endif
+
+void IndirectMiss();
+static uint32_t *indirect_adr[2];
+static uint32_t *indirect_ldr;
+
+/*
+    Emit probe of the inline cache of an indirect exit. The cache is searched for REG_PC and
+    on hit the code branches directly to the cached unit. An exit through RTS checks the return
+    address stack first. On miss IndirectMiss is called with
+    address of the cache in x0, it fills one slot if the unit exists already. If an interrupt
+    is pending or the instruction cache is disabled, probe falls through to the return
+    emitted by the caller. The cache itself is put behind that return by EMIT_IndirectCache.
+*/
+static uint32_t *EMIT_IndirectExit(uint32_t *ptr, int is_return)
+{
+    uint32_t *exit_branch;
+    uint32_t *hit[IBTC_SLOTS];
+
+    *ptr++ = mrs(0, 3, 3, 13, 0, 3);
+    *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KState, PINT));
+#if !EMU68_JIT_WRITE_PROTECT
+    *ptr++ = ldr_offset(0, 0, __builtin_offsetof(struct M68KState, CACR));
+#endif
+    exit_branch = ptr;
+    *ptr++ = cbnz(1, 0);
+#if !EMU68_JIT_WRITE_PROTECT
+    *ptr++ = tbz(0, CACRB_IE, 0);
+#endif
+
+#if EMU68_JIT_RETURN_STACK
+    /* Return, pop the return address stack and branch to its entry point if the address matches */
+    if (is_return)
+    {
+        *ptr++ = mrs(0, 3, 3, 13, 0, 3);
+        *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KState, RSTop));
+        *ptr++ = add64_reg(2, 0, 1, LSL, 4);
+        *ptr++ = sub_immed(1, 1, 1);
+        *ptr++ = and_immed(1, 1, RSTACK_BITS, 0);
+        *ptr++ = str_offset(0, 1, __builtin_offsetof(struct M68KState, RSTop));
+        *ptr++ = ldr_offset(2, 1, __builtin_offsetof(struct M68KState, RS[0].re_M68kPC));
+        *ptr++ = ldr64_offset(2, 2, __builtin_offsetof(struct M68KState, RS[0].re_ARMEntryPoint));
+        *ptr++ = cmp_reg(1, REG_PC, LSL, 0);
+        *ptr++ = b_cc(A64_CC_NE, 3);
+        *ptr++ = cbz_64(2, 2);
+        *ptr++ = br(2);
+    }
+#else
+    (void)is_return;
+#endif
+
+    indirect_adr[0] = ptr;
+    *ptr++ = adr(0, 0);
+    for (int i=0; i < IBTC_SLOTS; i++)
+    {
+        if (i == 0)
+            *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KIndirectSlot, is_M68kPC));
+        else
+            *ptr++ = ldr_offset_preindex(0, 1, sizeof(struct M68KIndirectSlot));
+        *ptr++ = cmp_reg(1, REG_PC, LSL, 0);
+        hit[i] = ptr;
+        *ptr++ = b_cc(A64_CC_EQ, 0);
+    }
+
+    /* Miss */
+    indirect_adr[1] = ptr;
+    *ptr++ = adr(0, 0);
+    indirect_ldr = ptr;
+    *ptr++ = ldr64_pcrel(1, 0);
+    *ptr++ = br(1);
+
+    /* Hit, x0 points to the matching slot */
+    for (int i=0; i < IBTC_SLOTS; i++)
+        *hit[i] = b_cc(A64_CC_EQ, ptr - hit[i]);
+    *ptr++ = ldr64_offset(0, 1, __builtin_offsetof(struct M68KIndirectSlot, is_ARMEntryPoint));
+    *ptr++ = br(1);
+
+    exit_branch[0] = cbnz(1, ptr - &exit_branch[0]);
+#if !EMU68_JIT_WRITE_PROTECT
+    exit_branch[1] = tbz(0, CACRB_IE, ptr - &exit_branch[1]);
+#endif
+
+    return ptr;
+}
+
+/*
+    Emit the inline cache probed by EMIT_IndirectExit. The cache is preceded by its offset
+    within the unit and index of the unit descriptor, so that IndirectMiss can find the
+    owner, and followed by address of the miss handler. The index is filled once the unit
+    gets its descriptor.
+*/
+static uint32_t *EMIT_IndirectCache(uint32_t *ptr, uint32_t *arm_code)
+{
+    union {
+        uint64_t u64;
+        uint32_t u32[2];
+    } u;
+
+    u.u64 = (uintptr_t)IndirectMiss;
+
+    if ((ptr - arm_code) & 1)
+        *ptr++ = udf(0);
+
+    indirect_header = ptr - arm_code;
+    *ptr = ptr + 2 - arm_code;
+    ptr[1] = 0;
+    ptr += 2;
+
+    *indirect_adr[0] = adr(0, (uintptr_t)ptr - (uintptr_t)indirect_adr[0]);
+    *indirect_adr[1] = adr(0, (uintptr_t)ptr - (uintptr_t)indirect_adr[1]);
+
+    for (int i=0; i < IBTC_SLOTS; i++)
+    {
+        if (exit_count < MAX_EXITS)
+        {
+            exit_offset[exit_count] = ptr - arm_code;
+            exit_target[exit_count] = NULL;
+            exit_type[exit_count] = EXIT_INDIRECT;
+            exit_count++;
+        }
+
+        /* Empty slot: is_M68kPC, is_Pad, is_ARMEntryPoint */
+        *ptr++ = IBTC_EMPTY;
+        *ptr++ = 0;
+        *ptr++ = 0;
+        *ptr++ = 0;
+    }
+
+    *indirect_ldr = ldr64_pcrel(1, ptr - indirect_ldr);
+    *ptr++ = BE32(u.u32[0]);
+    *ptr++ = BE32(u.u32[1]);
+
+    return ptr;
+}
+
+void TierUp();
+static uint32_t *tier_ldr[2];
+static uint32_t *tier_count_ldr[MAX_EXITS];
+static uint32_t tier_count_cnt;
+
+/*
+    Emit use counter of a tier 1 unit. The counter lives in the unit descriptor, whose address
+    is loaded from a literal filled once the descriptor is known. When the counter drops to
+    zero, TierUp is entered instead of the unit. All temporary registers are dead here.
+*/
+static uint32_t *EMIT_TierCounter(uint32_t *ptr)
+{
+    tier_ldr[0] = ptr;
+    *ptr++ = ldr64_pcrel(0, 0);
+    *ptr++ = ldr_offset(0, 1, __builtin_offsetof(struct M68KTranslationUnit, mt_HotCount));
+    *ptr++ = subs_immed(1, 1, 1);
+    *ptr++ = str_offset(0, 1, __builtin_offsetof(struct M68KTranslationUnit, mt_HotCount));
+    *ptr++ = b_cc(A64_CC_NE, 3);
+    tier_ldr[1] = ptr;
+    *ptr++ = ldr64_pcrel(1, 0);
+    *ptr++ = br(1);
+
+    return ptr;
+}
+
+/*
+    Emit counter of a side exit of tier 1 unit. It counts how often the exit which is about to
+    be registered was taken, M68K_TierUp turns the counts into hints for tier 2 translation.
+*/
+static uint32_t *EMIT_ExitCounter(uint32_t *ptr, uint16_t *target)
+{
+    uint32_t offset = exit_count * sizeof(struct M68KExitLink) + __builtin_offsetof(struct M68KExitLink, el_Count);
+
+    if (target == NULL || exit_count >= MAX_EXITS || offset > 16380)
+        return ptr;
+
+    tier_count_ldr[tier_count_cnt++] = ptr;
+    *ptr++ = ldr64_pcrel(0, 0);
+    *ptr++ = ldr64_offset(0, 0, __builtin_offsetof(struct M68KTranslationUnit, mt_Exits));
+    *ptr++ = ldr_offset(0, 1, offset);
+    *ptr++ = add_immed(1, 1, 1);
+    *ptr++ = str_offset(0, 1, offset);
+
+    return ptr;
+}
+
+/* Emit literals used by EMIT_TierCounter: address of the descriptor and of TierUp */
+static uint32_t *EMIT_TierLiterals(uint32_t *ptr, uint32_t *arm_code)
+{
+    union {
+        uint64_t u64;
+        uint32_t u32[2];
+    } u;
+
+    u.u64 = (uintptr_t)TierUp;
+
+    if ((ptr - arm_code) & 1)
+        *ptr++ = udf(0);
+
+    tier_literal = ptr - arm_code;
+    *tier_ldr[0] = ldr64_pcrel(0, ptr - tier_ldr[0]);
+    for (uint32_t i=0; i < tier_count_cnt; i++)
+        *tier_count_ldr[i] = ldr64_pcrel(0, ptr - tier_count_ldr[i]);
+    *ptr++ = 0;
+    *ptr++ = 0;
+
+    *tier_ldr[1] = ldr64_pcrel(1, ptr - tier_ldr[1]);
+    *ptr++ = BE32(u.u32[0]);
+    *ptr++ = BE32(u.u32[1]);
+
+    return ptr;
+}
+#endif
+
 #define RTSTACK_SIZE    32
 uint16_t *ReturnStack[RTSTACK_SIZE];
 uint16_t ReturnStackDepth = 0;
@@ -210,19 +596,202 @@ void M68K_ResetReturnStack()
     ReturnStackDepth = 0;
 }
 
+/*
+    Emit push of the return address to the return address stack of M68KState. Entry point of
+    the unit at the return address is taken from the jump cache of ExecutionLoop, if present.
+    Since the stack holds entry points, it is cleared whenever an entry of the jump cache is
+    dropped.
+*/
+uint32_t *EMIT_PushReturnStack(uint32_t *ptr, uint16_t *ret_addr)
+{
+#if defined(__aarch64__) && EMU68_JIT_RETURN_STACK
+    uint32_t pc = (uint32_t)(uintptr_t)ret_addr;
+    uintptr_t slot = (uintptr_t)&JumpCache[JCACHE_INDEX(pc)];
+    uint8_t ctx = RA_GetCTX(&ptr);
+    uint8_t addr = RA_AllocARMRegister(&ptr);
+    uint8_t tmp = RA_AllocARMRegister(&ptr);
+    uint8_t entry = RA_AllocARMRegister(&ptr);
+    uint8_t ret = RA_AllocARMRegister(&ptr);
+
+    *ptr++ = mov64_immed_u16(addr, slot & 0xffff, 0);
+    for (int i=1; i < 4; i++)
+    {
+        if ((slot >> (16 * i)) & 0xffff)
+            *ptr++ = movk64_immed_u16(addr, (slot >> (16 * i)) & 0xffff, i);
+    }
+    *ptr++ = movw_immed_u16(ret, pc & 0xffff);
+    if (pc >> 16)
+        *ptr++ = movt_immed_u16(ret, pc >> 16);
+
+    /* Entry point or NULL if the jump cache holds another unit */
+    *ptr++ = mov64_immed_u16(entry, 0, 0);
+    *ptr++ = ldr_offset(addr, tmp, __builtin_offsetof(struct M68KJumpCacheEntry, jc_M68kPC));
+    *ptr++ = cmp_reg(tmp, ret, LSL, 0);
+    *ptr++ = b_cc(A64_CC_NE, 2);
+    *ptr++ = ldr64_offset(addr, entry, __builtin_offsetof(struct M68KJumpCacheEntry, jc_ARMEntryPoint));
+
+    *ptr++ = ldr_offset(ctx, tmp, __builtin_offsetof(struct M68KState, RSTop));
+    *ptr++ = add_immed(tmp, tmp, 1);
+    *ptr++ = and_immed(tmp, tmp, RSTACK_BITS, 0);
+    *ptr++ = str_offset(ctx, tmp, __builtin_offsetof(struct M68KState, RSTop));
+    *ptr++ = add64_reg(addr, ctx, tmp, LSL, 4);
+    *ptr++ = str_offset(addr, ret, __builtin_offsetof(struct M68KState, RS[0].re_M68kPC));
+    *ptr++ = str64_offset(addr, entry, __builtin_offsetof(struct M68KState, RS[0].re_ARMEntryPoint));
+
+    RA_FreeARMRegister(&ptr, addr);
+    RA_FreeARMRegister(&ptr, tmp);
+    RA_FreeARMRegister(&ptr, entry);
+    RA_FreeARMRegister(&ptr, ret);
+#else
+    (void)ret_addr;
+#endif
+
+    return ptr;
+}
+
+/* Emit drop of the top entry of the return address stack, used by RTS of an inlined call */
+uint32_t *EMIT_PopReturnStack(uint32_t *ptr)
+{
+#if defined(__aarch64__) && EMU68_JIT_RETURN_STACK
+    uint8_t ctx = RA_GetCTX(&ptr);
+    uint8_t tmp = RA_AllocARMRegister(&ptr);
+
+    *ptr++ = ldr_offset(ctx, tmp, __builtin_offsetof(struct M68KState, RSTop));
+    *ptr++ = sub_immed(tmp, tmp, 1);
+    *ptr++ = and_immed(tmp, tmp, RSTACK_BITS, 0);
+    *ptr++ = str_offset(ctx, tmp, __builtin_offsetof(struct M68KState, RSTop));
+
+    RA_FreeARMRegister(&ptr, tmp);
+#endif
+
+    return ptr;
+}
+
+/* Drop all entries of the return address stack, their entry points may not be valid anymore */
+void M68K_ClearReturnStack()
+{
+#if defined(__aarch64__) && EMU68_JIT_RETURN_STACK
+    if (__m68k_state)
+        bzero(__m68k_state->RS, sizeof(__m68k_state->RS));
+#endif
+}
+
 uint16_t *m68k_high;
 uint16_t *m68k_low;
 uint32_t insn_count;
 uint32_t prologue_size = 0;
 uint32_t epilogue_size = 0;
 uint32_t conditionals_count = 0;
+uint32_t optimized_count = 0;
 
-extern struct M68KState *__m68k_state;
 void M68K_PrintContext(void *);
 
-static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
+#if defined(__aarch64__) && EMU68_JIT_NATIVE_LOOPS
+/* Latest translation of the m68k instruction in current unit usable as loop head, -1 if none */
+static int M68K_FindLoopHead(uint16_t *m68kcodeptr)
+{
+    for (int i=insn_count - 1; i >= 0; --i)
+    {
+        if (local_state[i].mls_M68kPtr == m68kcodeptr)
+            return local_state[i].mls_Flushed ? i : -1;
+    }
+
+    return -1;
+}
+#endif
+
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+/* End of host code of an instruction, without the translator markers following it */
+static uint32_t *M68K_SkipMarkers(uint32_t *end)
+{
+    if (end[-1] == INSN_TO_LE(0xfffffff0))
+        end--;
+    if (end[-1] == INSN_TO_LE(0xffffffff))
+    {
+        end--;
+        if (end[-1] == INSN_TO_LE(0xfffffffd))
+            end -= 2;
+        else if (end[-1] == INSN_TO_LE(0xfffffffc) || end[-1] == INSN_TO_LE(0xfffffffb))
+            end--;
+    }
+    if (end[-1] == INSN_TO_LE(0xfffffffe))
+        end -= 3 + end[-3];
+
+    return end;
+}
+#endif
+
+#if defined(__aarch64__) && EMU68_JIT_IR
+/* Lower current IR block ending at end, count host instructions removed by the passes */
+static uint32_t *M68K_LowerIR(uint32_t *arm_code, uint32_t *end, uint16_t live_temps)
+{
+    uint32_t *lowered = IR_Lower(arm_code, end, local_state, live_temps);
+
+    optimized_count += end - lowered;
+
+    return lowered;
+}
+
+/*
+    Add code of the instruction just translated to the IR block. If it cannot be lifted, the
+    block is lowered and the code of the instruction moved down to its new end. Branch
+    locations passed with the conditional exit marker move with it.
+*/
+static uint32_t *M68K_LiftINSN(uint32_t *arm_code, uint32_t *start, uint32_t *end, uint16_t live_temps)
+{
+    struct M68KLocalState *ls = &local_state[insn_count - 1];
+    int leader = IR_IsEmpty();
+    uint32_t *block_end;
+    uint32_t shift;
+
+    if (IR_Lift(start, end, insn_count - 1))
+    {
+        /* Only the first instruction of a block may be a loop head */
+        if (!leader)
+            ls->mls_Flushed = 0;
+        return end;
+    }
+
+    block_end = M68K_LowerIR(arm_code, start, live_temps);
+    shift = start - block_end;
+
+    if (shift)
+    {
+        uint32_t *marker;
+
+        memmove(block_end, start, 4 * (end - start));
+        end -= shift;
+        ls->mls_ARMOffset = block_end - arm_code;
+
+        marker = end;
+        if (marker[-1] == INSN_TO_LE(0xfffffff0))
+            marker--;
+        if (marker[-1] == INSN_TO_LE(0xffffffff))
+        {
+            marker--;
+            if (marker[-1] == INSN_TO_LE(0xfffffffd))
+                marker -= 2;
+            else if (marker[-1] == INSN_TO_LE(0xfffffffc) || marker[-1] == INSN_TO_LE(0xfffffffb))
+                marker--;
+        }
+        if (marker[-1] == INSN_TO_LE(0xfffffffe))
+        {
+            for (uint32_t i=0; i < marker[-3]; i++)
+                marker[-4 - i] -= 4 * shift;
+        }
+    }
+
+    return end;
+}
+#endif
+
+/*
+    Translate m68k code into temporary buffer. Tier 0 code is not cached, tier 1 units are short
+    and count their uses, tier 2 units are translated to the full depth.
+*/
+static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr, int tier)
 {
-    uintptr_t hash = (uintptr_t)m68kcodeptr;
+    uint16_t depth = Policy_GetDepth(m68kcodeptr, tier);
     uint32_t *pop_update_loc[EMU68_M68K_INSN_DEPTH];
     uint32_t pop_cnt=0;
 
@@ -232,16 +801,33 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
     M68K_ResetReturnStack();
 
     if (debug) {
-        kprintf("[ICache] Creating new translation unit with hash %04x (m68k code @ %p)\n", (hash ^ (hash >> 16)) & 0xffff, (void*)m68kcodeptr);
+        kprintf("[ICache] Creating new translation unit with hash %04x (m68k code @ %p)\n", (int)(ICACHE_HASH(m68kcodeptr) & ICacheMask), (void*)m68kcodeptr);
         if (debug > 1)
             M68K_PrintContext(__m68k_state);
     }
 
     int lr_is_saved = 0;
-    
+    int indirect_exit = 0;
+    uint16_t *unit_exit = NULL;
+
+    exit_count = 0;
+    indirect_header = 0;
+    tier_literal = 0;
+
+#ifdef __aarch64__
+    tier_count_cnt = 0;
+    if (tier == 1 && depth > EMU68_JIT_TIER1_DEPTH)
+        depth = EMU68_JIT_TIER1_DEPTH;
+#else
+    (void)tier;
+#endif
     prologue_size = 0;
     epilogue_size = 0;
     conditionals_count = 0;
+    optimized_count = 0;
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+    RA_ResetKnownValues();
+#endif
 
     insn_count = 0;
     uint32_t *arm_code = temporary_arm_code;
@@ -249,6 +835,8 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
 
     (void)prologue_size;
     (void)lr_is_saved;
+    (void)unit_exit;
+    (void)indirect_exit;
 
     RA_ClearChangedMask();
 
@@ -271,13 +859,16 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
         *end++ = msr(reg, 3, 3, 9, 12, 4);
         RA_FreeARMRegister(&end, reg);
     }
+
+    if (tier == 1)
+        end = EMIT_TierCounter(end);
 #endif
 
     prologue_size = end - tmpptr;
 
     int break_loop = FALSE;
 
-    while (break_loop == FALSE && *m68kcodeptr != 0xffff && insn_count < Options.M68K_TRANSLATION_DEPTH)
+    while (break_loop == FALSE && *m68kcodeptr != 0xffff && insn_count < depth)
     {
         if (insn_count && ((uintptr_t)m68kcodeptr < (uintptr_t)local_state[insn_count-1].mls_M68kPtr))
         {
@@ -293,14 +884,48 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
                 }
             }
 
+#if defined(__aarch64__) && EMU68_JIT_NATIVE_LOOPS
+            /* Loop head translated with clean state, close the loop with a native branch */
+#if defined(__aarch64__) && EMU68_JIT_IR
+            /* Code jumping back into the unit follows, the IR block ends here */
+            if (found >= 0)
+                end = M68K_LowerIR(arm_code, end, RA_GetTempAllocMask());
+#endif
+            if (found >= 0 && local_state[found].mls_Flushed)
+            {
+                RA_FlushCC(&end);
+                RA_FlushFPCR(&end);
+                RA_FlushFPSR(&end);
+                RA_FlushCTX(&end);
+                end = EMIT_LoopBackEdge(end, arm_code, &local_state[found]);
+                break;
+            }
+#endif
             if (found > 0)
             {
-                if ((insn_count - found - 1) > (Options.M68K_TRANSLATION_DEPTH - insn_count))
+                if ((insn_count - found - 1) > (depth - insn_count))
                 {
 //                        kprintf("not enough place for completion of the loop\n");
                     break;
                 }
             }
+#if defined(__aarch64__) && EMU68_JIT_NATIVE_LOOPS
+            /*
+                Head was translated with state cached in registers. Translate the body once more,
+                starting with flushed state, so that the next pass ends with a native back-edge.
+            */
+            if (found >= 0)
+            {
+                RA_FlushCC(&end);
+                RA_FlushFPCR(&end);
+                RA_FlushFPSR(&end);
+                RA_FlushCTX(&end);
+#if EMU68_JIT_KNOWN_VALUES
+                /* Values known before the loop would keep the next copy from being a loop head */
+                RA_ResetKnownValues();
+#endif
+            }
+#endif
         }
 
         if (m68kcodeptr < m68k_low)
@@ -311,12 +936,38 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
         local_state[insn_count].mls_ARMOffset = end - arm_code;
         local_state[insn_count].mls_M68kPtr = m68kcodeptr;
         local_state[insn_count].mls_PCRel = _pc_rel;
-#ifndef __aarch64__
+#ifdef __aarch64__
+        local_state[insn_count].mls_Flushed = RA_IsStateFlushed();
+        RA_GetModifiedState(local_state[insn_count].mls_Modified);
+#else
         for (int r=0; r < 16; r++)
             local_state[insn_count].mls_RegMap[r] = RA_GetMappedARMRegister(r);
+        for (int r=0; r < 3; r++)
+            local_state[insn_count].mls_Modified[r] = 0xff;
+#endif
+#if defined(__aarch64__) && EMU68_JIT_IR
+        uint16_t live_temps = RA_GetTempAllocMask();
+#endif
+#if defined(__aarch64__) && (EMU68_JIT_IR || EMU68_JIT_KNOWN_VALUES)
+        uint32_t *insn_start = end;
 #endif
         end = EmitINSN(end, &m68kcodeptr);
         insn_count++;
+#if defined(__aarch64__) && EMU68_JIT_KNOWN_VALUES
+        {
+            int since = RA_UpdateKnownValues(IR_GetDefs(insn_start, M68K_SkipMarkers(end)), insn_count - 1);
+
+            /* Code relies on values set before, loop heads in between would see other values */
+            if (since >= 0)
+            {
+                for (uint32_t i=since + 1; i < insn_count; i++)
+                    local_state[i].mls_Flushed = 0;
+            }
+        }
+#endif
+#if defined(__aarch64__) && EMU68_JIT_IR
+        end = M68K_LiftINSN(arm_code, insn_start, end, live_temps);
+#endif
         if (end[-1] == INSN_TO_LE(0xfffffff0))
         {
             lr_is_saved = 1;
@@ -326,16 +977,37 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
         {
             end--;
             break_loop = TRUE;
+
+            /* Unit ends with a jump to a constant m68k address */
+            if (end[-1] == INSN_TO_LE(0xfffffffd))
+            {
+                end--;
+                unit_exit = (uint16_t *)(uintptr_t)*--end;
+            }
+            /* Unit ends with a jump to address computed at run time */
+            else if (end[-1] == INSN_TO_LE(0xfffffffc))
+            {
+                end--;
+                indirect_exit = 1;
+            }
+            /* Unit ends with a return, the address was popped from m68k stack */
+            else if (end[-1] == INSN_TO_LE(0xfffffffb))
+            {
+                end--;
+                indirect_exit = 2;
+            }
         }
         if (end[-1] == INSN_TO_LE(0xfffffffe))
         {
             uint32_t *tmpptr;
             uint32_t *branch_mod[10];
             uint32_t branch_cnt;
+            uint16_t *side_exit;
             int local_branch_done = 0;
             end--;
-            end--;  /* Remove branch target (unused!) */
+            side_exit = (uint16_t *)(uintptr_t)*--end;  /* m68k address of the side exit, 0 if unknown */
             branch_cnt = *--end;
+            (void)side_exit;
 
             for (unsigned i=0; i < branch_cnt; i++)
             {
@@ -369,6 +1041,21 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
                 RA_StoreCC(&end);
                 RA_StoreFPCR(&end);
                 RA_StoreFPSR(&end);
+
+#if EMU68_JIT_NATIVE_LOOPS
+                /* Side exit jumping back into the unit, e.g. DBcc or a Bcc not followed */
+                int head = side_exit ? M68K_FindLoopHead(side_exit) : -1;
+
+                if (head >= 0)
+                    end = EMIT_LoopBackEdge(end, arm_code, &local_state[head]);
+                else
+#endif
+                {
+                    /* Counter belongs to the exit registered right after it */
+                    if (tier == 1)
+                        end = EMIT_ExitCounter(end, side_exit);
+                    end = EMIT_ChainableExit(end, arm_code, side_exit);
+                }
 #endif
                 pop_update_loc[pop_cnt++] = end;
 #ifndef __aarch64__
@@ -392,6 +1079,13 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
             epilogue_size += distance;
         }
     }
+#if defined(__aarch64__) && EMU68_JIT_IR
+    end = M68K_LowerIR(arm_code, end, RA_GetTempAllocMask());
+#endif
+    /* Translation stopped before an instruction which is not part of the unit, continue there */
+    if (!break_loop && *m68kcodeptr != 0xffff)
+        unit_exit = m68kcodeptr;
+
     tmpptr = end;
     RA_FlushFPURegs(&end);
     RA_FlushM68kRegs(&end);
@@ -413,6 +1107,11 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
     RA_FlushFPCR(&end);
     RA_FlushFPSR(&end);
     RA_FlushCTX(&end);
+
+    if (indirect_exit)
+        end = EMIT_IndirectExit(end, indirect_exit == 2);
+    else
+        end = EMIT_ChainableExit(end, arm_code, unit_exit);
 #endif
     {
 #ifndef __aarch64__
@@ -453,6 +1152,13 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
         *end++ = bx_lr();
     epilogue_size += end - tmpptr;
 
+#ifdef __aarch64__
+    if (indirect_exit)
+        end = EMIT_IndirectCache(end, arm_code);
+    if (tier == 1)
+        end = EMIT_TierLiterals(end, arm_code);
+#endif
+
     // Put a marker at the end of translation unit
     *end++ = 0xffffffff;
 
@@ -462,6 +1168,7 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
         kprintf("[ICache]   Prologue size: %d, Epilogue size: %d, Conditionals: %d\n",
             prologue_size, epilogue_size, conditionals_count);
         kprintf("[ICache]   Mean epilogue size pro exit point: %d\n", epilogue_size / (1 + conditionals_count));
+        kprintf("[ICache]   ARM instructions removed by optimizer: %d\n", optimized_count);
         uint32_t mean = 100 * (end - arm_code - (prologue_size + epilogue_size));
         mean = mean / insn_count;
         uint32_t mean_n = mean / 100;
@@ -479,7 +1186,7 @@ static inline uintptr_t M68K_Translate(uint16_t *m68kcodeptr)
 */
 void *M68K_TranslateNoCache(uint16_t *m68kcodeptr)
 {
-    uintptr_t line_length = M68K_Translate(m68kcodeptr);
+    uintptr_t line_length = M68K_Translate(m68kcodeptr, 0);
     void *entry_point = (void*)temporary_arm_code;
 
 #ifdef __aarch64__
@@ -492,195 +1199,1447 @@ void *M68K_TranslateNoCache(uint16_t *m68kcodeptr)
     return entry_point;
 } 
 
+static void M68K_ReviveUnit(struct M68KTranslationUnit *unit);
+
 /*
     Verify if the translated code has changed since the unit was created. In order
-    to do this MD5 sum of the block is compared with the previousy calculated one.
+    to do this fingerprint of the block is compared with the previousy calculated one.
+
+    If th sums are not same, the block is removed form LRU cache and hashtable and memory
+    is released. Suspect unit which did not change is revived.
+
+    The function returns poitner to verified unit or NULL if the unit changed
+*/
+struct M68KTranslationUnit *M68K_VerifyUnit(struct M68KTranslationUnit *unit)
+{
+    if (unit)
+    {
+        if (!Fingerprint_Check(&unit->mt_Fingerprint, unit->mt_M68kLow, unit->mt_M68kHigh))
+        {
+            M68K_LockCache();
+            M68K_FreeUnit(unit);
+            M68K_UnlockCache();
+            unit = NULL;
+        }
+        else if (unit->mt_Verify & VERIFY_SUSPECT)
+        {
+            M68K_LockCache();
+            M68K_ReviveUnit(unit);
+            M68K_UnlockCache();
+        }
+    }
+
+    return unit;
+}
+
+/*
+    Write the exit slot of a unit. With target given, the slot becomes a direct branch to
+    the target unit, otherwise it returns to ExecutionLoop again. Both code aliases map the
+    same memory, so the branch offset is computed on the writable one. No cache maintenance
+    is done here.
+*/
+static uint32_t *M68K_WriteExit(struct M68KExitLink *link, struct M68KTranslationUnit *target)
+{
+    uint32_t *site = &link->el_Owner->mt_ARMCode[link->el_Offset];
+
+    link->el_Target = target;
+
+    /* Slots of inline cache are data */
+    if (link->el_Type == EXIT_INDIRECT)
+    {
+        struct M68KIndirectSlot *slot = (struct M68KIndirectSlot *)site;
+
+        if (target)
+        {
+            slot->is_ARMEntryPoint = target->mt_ARMEntryPoint;
+            slot->is_M68kPC = (uint32_t)(uintptr_t)target->mt_M68kAddress;
+        }
+        else
+        {
+            slot->is_M68kPC = IBTC_EMPTY;
+            slot->is_ARMEntryPoint = NULL;
+        }
+
+        return site;
+    }
+
+#ifdef __aarch64__
+    if (target)
+        *site = b(&target->mt_ARMCode[0] - site);
+    else
+        *site = bx_lr();
+#endif
+
+    return site;
+}
+
+/* Patch the exit slot of a unit and make the change visible to instruction fetch */
+static void M68K_PatchExit(struct M68KExitLink *link, struct M68KTranslationUnit *target)
+{
+    uint32_t *site = M68K_WriteExit(link, target);
+
+#ifdef __aarch64__
+    if (link->el_Type == EXIT_DIRECT)
+    {
+        arm_flush_cache((uintptr_t)site, 4);
+        arm_icache_invalidate((uintptr_t)site | 0x0000001000000000, 4);
+    }
+#else
+    (void)site;
+#endif
+}
+
+/* Find unit in the cache without updating the LRU */
+static struct M68KTranslationUnit *M68K_LookupUnit(uint16_t *ptr)
+{
+    uint32_t pc = (uint32_t)(uintptr_t)ptr;
+
+    for (uint32_t b = ICACHE_HASH(pc) & ICacheMask; ; b = (b + 1) & ICacheMask)
+    {
+        for (int i=0; i < ICACHE_BUCKET_SLOTS; i++)
+        {
+            if (ICache[b].cb_M68kPC[i] == pc)
+                return (struct M68KTranslationUnit *)((uintptr_t)jit_tlsf + ICache[b].cb_Unit[i]);
+            else if (ICache[b].cb_M68kPC[i] == ICACHE_EMPTY)
+                return NULL;
+        }
+    }
+}
+
+/* Store unit in the first free slot following its home bucket */
+static void ICache_Insert(struct M68KICacheBucket *table, uint32_t mask, uint32_t pc, uint32_t unit, void *entry)
+{
+    for (uint32_t b = ICACHE_HASH(pc) & mask; ; b = (b + 1) & mask)
+    {
+        for (int i=0; i < ICACHE_BUCKET_SLOTS; i++)
+        {
+            if (table[b].cb_M68kPC[i] == ICACHE_EMPTY)
+            {
+                table[b].cb_Unit[i] = unit;
+                table[b].cb_ARMEntryPoint[i] = entry;
+#ifdef __aarch64__
+                /* ExecutionLoop may probe the table concurrently, publish the PC last */
+                asm volatile("dmb ishst":::"memory");
+#endif
+                table[b].cb_M68kPC[i] = pc;
+                return;
+            }
+        }
+    }
+}
+
+/*
+    Remove unit from the hash table. Slots are treated as one flat array and entries following
+    the removed one are shifted back, so that no probe sequence gets interrupted by the hole.
+*/
+static void ICache_Remove(uint32_t pc)
+{
+    uint32_t slot_mask = (ICacheMask + 1) * ICACHE_BUCKET_SLOTS - 1;
+    uint32_t hole = (ICACHE_HASH(pc) & ICacheMask) * ICACHE_BUCKET_SLOTS;
+
+    while (ICache[hole / ICACHE_BUCKET_SLOTS].cb_M68kPC[hole % ICACHE_BUCKET_SLOTS] != pc)
+    {
+        if (ICache[hole / ICACHE_BUCKET_SLOTS].cb_M68kPC[hole % ICACHE_BUCKET_SLOTS] == ICACHE_EMPTY)
+            return;
+        hole = (hole + 1) & slot_mask;
+    }
+
+    for (uint32_t j = (hole + 1) & slot_mask; ; j = (j + 1) & slot_mask)
+    {
+        struct M68KICacheBucket *src = &ICache[j / ICACHE_BUCKET_SLOTS];
+        struct M68KICacheBucket *dst = &ICache[hole / ICACHE_BUCKET_SLOTS];
+        uint32_t s = j % ICACHE_BUCKET_SLOTS;
+        uint32_t d = hole % ICACHE_BUCKET_SLOTS;
+        uint32_t home;
+
+        if (src->cb_M68kPC[s] == ICACHE_EMPTY)
+            break;
+
+        /* Entry may be moved only if the hole lies between its home slot and the entry itself */
+        home = (ICACHE_HASH(src->cb_M68kPC[s]) & ICacheMask) * ICACHE_BUCKET_SLOTS;
+        if (((j - home) & slot_mask) >= ((j - hole) & slot_mask))
+        {
+            dst->cb_M68kPC[d] = src->cb_M68kPC[s];
+            dst->cb_Unit[d] = src->cb_Unit[s];
+            dst->cb_ARMEntryPoint[d] = src->cb_ARMEntryPoint[s];
+            hole = j;
+        }
+    }
+
+    ICache[hole / ICACHE_BUCKET_SLOTS].cb_M68kPC[hole % ICACHE_BUCKET_SLOTS] = ICACHE_EMPTY;
+    ICacheUnits--;
+}
+
+/* Drop unit from the jump cache of ExecutionLoop */
+static void JumpCache_Remove(uint32_t pc)
+{
+    struct M68KJumpCacheEntry *e = &JumpCache[JCACHE_INDEX(pc)];
+
+    if (e->jc_M68kPC == pc)
+        e->jc_M68kPC = ICACHE_EMPTY;
+
+    /* Return address stack could have got the entry point earlier */
+    M68K_ClearReturnStack();
+}
+
+/* Update location of a unit which has been moved to another place in the code cache */
+static void ICache_Update(uint32_t pc, uint32_t unit, void *entry)
+{
+    for (uint32_t b = ICACHE_HASH(pc) & ICacheMask; ; b = (b + 1) & ICacheMask)
+    {
+        for (int i=0; i < ICACHE_BUCKET_SLOTS; i++)
+        {
+            if (ICache[b].cb_M68kPC[i] == pc)
+            {
+                ICache[b].cb_Unit[i] = unit;
+                ICache[b].cb_ARMEntryPoint[i] = entry;
+                return;
+            }
+            else if (ICache[b].cb_M68kPC[i] == ICACHE_EMPTY)
+                return;
+        }
+    }
+}
+
+/*
+    Make sure the hash table can take one more unit. Table is doubled once it is filled in 3/4.
+    Returns 0 if the larger table could not be allocated and the table is full.
+*/
+static int ICache_Reserve()
+{
+    uint32_t slots = (ICacheMask + 1) * ICACHE_BUCKET_SLOTS;
+    uint32_t new_mask = 2 * ICacheMask + 1;
+    struct M68KICacheBucket *table;
+
+    if (4 * (ICacheUnits + 1) <= 3 * slots)
+        return 1;
+
+    table = tlsf_malloc_aligned(tlsf, sizeof(struct M68KICacheBucket) * (new_mask + 1), 64);
+    if (table == NULL)
+        return 0;
+
+    kprintf("[ICache] Growing hash table to %d buckets\n", new_mask + 1);
+
+    memset(table, 0xff, sizeof(struct M68KICacheBucket) * (new_mask + 1));
+
+    for (uint32_t b = 0; b <= ICacheMask; b++)
+    {
+        for (int i=0; i < ICACHE_BUCKET_SLOTS; i++)
+        {
+            if (ICache[b].cb_M68kPC[i] != ICACHE_EMPTY)
+                ICache_Insert(table, new_mask, ICache[b].cb_M68kPC[i], ICache[b].cb_Unit[i], ICache[b].cb_ARMEntryPoint[i]);
+        }
+    }
+
+    tlsf_free(tlsf, ICache);
+    ICache = table;
+    ICacheMask = new_mask;
+
+    return 1;
+}
+
+/* Chain exits of a freshly created unit to the units already in the cache */
+static void M68K_LinkExits(struct M68KTranslationUnit *unit)
+{
+    for (uint32_t i=0; i < unit->mt_ExitCount; i++)
+    {
+        struct M68KExitLink *link = &unit->mt_Exits[i];
+        struct M68KTranslationUnit *target;
+
+        if (link->el_Type == EXIT_INDIRECT)
+        {
+            ADDHEAD(&IdleExits, &link->el_Node);
+            continue;
+        }
+
+        target = M68K_LookupUnit(link->el_M68kTarget);
+
+        /* Units which have to be verified before each run are always entered through ExecutionLoop */
+        if (target && !target->mt_Verify)
+        {
+            ADDHEAD(&target->mt_Incoming, &link->el_Node);
+            M68K_PatchExit(link, target);
+        }
+        else
+            ADDHEAD(&PendingExits[EXIT_HASH(link->el_M68kTarget)], &link->el_Node);
+    }
+}
+
+/*
+    Chain all pending exits of other units which were waiting for this one. The exits are
+    rewritten in place, so this is done by the main core only, while no translated code runs.
+*/
+static void M68K_LinkPending(struct M68KTranslationUnit *unit)
+{
+    struct List *pending = &PendingExits[EXIT_HASH(unit->mt_M68kAddress)];
+    struct Node *n, *next;
+
+    if (unit->mt_Verify)
+        return;
+
+    ForeachNodeSafe(pending, n, next)
+    {
+        struct M68KExitLink *link = (struct M68KExitLink *)n;
+
+        if (link->el_M68kTarget == unit->mt_M68kAddress)
+        {
+            REMOVE(n);
+            ADDHEAD(&unit->mt_Incoming, n);
+            M68K_PatchExit(link, unit);
+        }
+    }
+}
+
+/* Redirect all exits chained to the unit back to ExecutionLoop, they become pending again */
+static void M68K_UnlinkIncoming(struct M68KTranslationUnit *unit)
+{
+    struct Node *n;
+
+    while ((n = REMHEAD(&unit->mt_Incoming)))
+    {
+        struct M68KExitLink *link = (struct M68KExitLink *)n;
+
+        M68K_PatchExit(link, NULL);
+        if (link->el_Type == EXIT_INDIRECT)
+            ADDHEAD(&IdleExits, n);
+        else
+            ADDHEAD(&PendingExits[EXIT_HASH(link->el_M68kTarget)], n);
+    }
+}
+
+/* Suspect unit was found unchanged, it can be chained and dispatched directly again */
+static void M68K_ReviveUnit(struct M68KTranslationUnit *unit)
+{
+    unit->mt_Verify &= ~VERIFY_SUSPECT;
+    M68K_LinkPending(unit);
+    cache_revivals++;
+}
+
+/* Number of 4K pages overlapped by the range, the end of the range is exclusive */
+static inline uint32_t M68K_PageSpan(uint16_t *low, uint16_t *high)
+{
+    return (((uintptr_t)high - 1) >> 12) - ((uintptr_t)low >> 12) + 1;
+}
+
+/* Number of page links needed by the unit covering given range */
+static inline uint32_t M68K_PageLinks(uint16_t *low, uint16_t *high)
+{
+    uint32_t span = M68K_PageSpan(low, high);
+
+    return span > PAGE_SPAN ? 1 : span;
+}
+
+static void PageIndex_Insert(struct M68KTranslationUnit *unit)
+{
+    uintptr_t page = (uintptr_t)unit->mt_M68kLow >> 12;
+
+    for (uint32_t i=0; i < unit->mt_PageCount; i++)
+        unit->mt_Pages[i].pl_Unit = unit;
+
+    if (M68K_PageSpan(unit->mt_M68kLow, unit->mt_M68kHigh) > PAGE_SPAN)
+        ADDHEAD(&WideUnits, &unit->mt_Pages[0].pl_Node);
+    else
+    {
+        for (uint32_t i=0; i < unit->mt_PageCount; i++)
+            ADDHEAD(&PageUnits[PAGE_HASH(page + i)], &unit->mt_Pages[i].pl_Node);
+    }
+}
+
+static void PageIndex_Remove(struct M68KTranslationUnit *unit)
+{
+    for (uint32_t i=0; i < unit->mt_PageCount; i++)
+        REMOVE(&unit->mt_Pages[i].pl_Node);
+}
+
+/*
+    Take unit out of all lookup structures. All exits of other units chained to this unit are
+    redirected back to ExecutionLoop and become pending again.
+*/
+static void M68K_DetachUnit(struct M68KTranslationUnit *unit)
+{
+    /* Own exits go away with the unit, including links of the unit to itself */
+    for (uint32_t i=0; i < unit->mt_ExitCount; i++)
+        REMOVE(&unit->mt_Exits[i].el_Node);
+
+    M68K_UnlinkIncoming(unit);
+
+    REMOVE(&unit->mt_LRUNode);
+    PageIndex_Remove(unit);
+    ICache_Remove((uint32_t)(uintptr_t)unit->mt_M68kAddress);
+    JumpCache_Remove((uint32_t)(uintptr_t)unit->mt_M68kAddress);
+
+    unit->mt_ARMEntryPoint = NULL;
+}
+
+/* Give back exits and fingerprint of a detached unit and put its descriptor on the free list */
+static void M68K_ReleaseUnit(struct M68KTranslationUnit *unit)
+{
+    /* Page links and PC side table share the allocation with exits */
+    if (unit->mt_Exits)
+        tlsf_free(jit_tlsf, unit->mt_Exits);
+    unit->mt_Exits = NULL;
+    unit->mt_ExitCount = 0;
+    Fingerprint_Release(&unit->mt_Fingerprint);
+
+    ADDHEAD(&FreeUnits, &unit->mt_LRUNode);
+}
+
+/*
+    Remove unit from the cache. The descriptor is released at once, code memory is given back
+    when the whole region is reclaimed.
+*/
+void M68K_FreeUnit(struct M68KTranslationUnit *unit)
+{
+    M68K_DetachUnit(unit);
+    M68K_ReleaseUnit(unit);
+}
+
+/* Release units retired since the last call, none of them can be running anymore */
+static void M68K_ReleaseRetired()
+{
+    struct Node *n;
+
+    while ((n = REMHEAD(&RetiredUnits)))
+        M68K_ReleaseUnit((struct M68KTranslationUnit *)((intptr_t)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode)));
+}
+
+static uint32_t M68K_FreeIfOverlaps(struct M68KTranslationUnit *u, uintptr_t start, uintptr_t end)
+{
+    if ((uintptr_t)u->mt_M68kLow >= end || (uintptr_t)u->mt_M68kHigh <= start)
+        return 0;
+
+    /*
+        The unit may be running just now, it has to return to ExecutionLoop once it is done.
+        Its exits and inline cache slots are emptied, the descriptor and exits the unit's
+        counters write to are kept until ExecutionLoop translates or tiers up next time.
+    */
+    for (uint32_t i=0; i < u->mt_ExitCount; i++)
+    {
+        if (u->mt_Exits[i].el_Target)
+            M68K_PatchExit(&u->mt_Exits[i], NULL);
+    }
+
+    M68K_DetachUnit(u);
+    ADDHEAD(&RetiredUnits, &u->mt_LRUNode);
+
+    return 1;
+}
+
+/*
+    Remove all units whose m68k code overlaps given range. Only units found in the page index
+    under pages of the range are checked, so the cost is proportional to the size of the range
+    and not to the number of cached units. Has to be called with the cache lock held. Returns
+    number of removed units.
+*/
+uint32_t M68K_FreeRange(uintptr_t start, uintptr_t end)
+{
+    struct Node *n, *next;
+    uint32_t count = 0;
+    uintptr_t first = start >> 12;
+    uintptr_t last = (end - 1) >> 12;
+
+    /* Every bucket has to be checked only once */
+    if (last - first >= PAGE_HASH_SIZE)
+        last = first + PAGE_HASH_SIZE - 1;
+
+    /*
+        Removing a unit takes its links off all lists. The next node of a list belongs to
+        another unit then, since a unit never has two links in one bucket.
+    */
+    for (uintptr_t page = first; page <= last; page++)
+    {
+        ForeachNodeSafe(&PageUnits[PAGE_HASH(page)], n, next)
+            count += M68K_FreeIfOverlaps(((struct M68KPageLink *)n)->pl_Unit, start, end);
+    }
+
+    ForeachNodeSafe(&WideUnits, n, next)
+        count += M68K_FreeIfOverlaps(((struct M68KPageLink *)n)->pl_Unit, start, end);
+
+    return count;
+}
+
+#ifdef __aarch64__
+/*
+    Called from IndirectMiss when the inline cache of an indirect exit does not contain
+    the requested PC. If the unit is present in the cache already, it is stored in an empty
+    slot or, if all slots are used, in the slot selected by the PC. Returns entry point of
+    the unit or NULL if it needs to be translated by ExecutionLoop.
+*/
+void *M68K_ResolveIndirect(struct M68KIndirectSlot *slots, uint32_t pc)
+{
+    struct M68KTranslationUnit *owner, *target;
+    struct M68KExitLink *link = NULL;
+    uint32_t offset;
+
+    target = M68K_FindTranslationUnit((uint16_t *)(uintptr_t)pc);
+    if (target == NULL || target->mt_Verify)
+        return NULL;
+
+    M68K_LockCache();
+
+    slots = (struct M68KIndirectSlot *)((uintptr_t)slots & ~0x0000001000000000);
+    offset = ((uint32_t *)slots)[-2];
+    owner = &Units[((uint32_t *)slots)[-1]];
+
+    /* Owner removed in the meantime, its descriptor may belong to another unit already */
+    if (owner->mt_ARMEntryPoint == NULL || (uint32_t *)slots != &owner->mt_ARMCode[offset])
+    {
+        M68K_UnlockCache();
+        return target->mt_ARMEntryPoint;
+    }
+
+    for (uint32_t i=0; i < owner->mt_ExitCount; i++)
+    {
+        struct M68KExitLink *l = &owner->mt_Exits[i];
+
+        if (l->el_Type != EXIT_INDIRECT)
+            continue;
+
+        if (l->el_Target == NULL)
+        {
+            link = l;
+            break;
+        }
+        if (l->el_Offset == offset + ((pc >> 1) & (IBTC_SLOTS - 1)) * sizeof(struct M68KIndirectSlot) / 4)
+            link = l;
+    }
+
+    if (link)
+    {
+        REMOVE(&link->el_Node);
+        ADDHEAD(&target->mt_Incoming, &link->el_Node);
+        M68K_PatchExit(link, target);
+    }
+
+    M68K_UnlockCache();
+
+    return target->mt_ARMEntryPoint;
+}
+#endif
+
+/* Forget the unit remembered by ExecutionLoop, it could have been moved or removed */
+static void M68K_ResetLastPC()
+{
+#ifdef __aarch64__
+    asm volatile("msr tpidr_el1, %0"::"r"(0xffffffff));
+#else
+    extern uint32_t last_PC;
+    last_PC = 0xffffffff;
+#endif
+}
+
+static void *Region_Alloc(struct M68KCodeRegion *region, uintptr_t size)
+{
+    uintptr_t ptr = region->cr_Top;
+
+    if (ptr + size > region->cr_End)
+        return NULL;
+
+    region->cr_Top = ptr + size;
+
+    return (void *)ptr;
+}
+
+/* Write back part of a region filled with code and invalidate its executable alias */
+static void Region_Flush(uintptr_t start, uintptr_t end)
+{
+    if (end == start)
+        return;
+
+    arm_flush_cache(start, end - start);
+#ifdef __aarch64__
+    arm_icache_invalidate(start | 0x0000001000000000, end - start);
+#else
+    arm_icache_invalidate(start, end - start);
+#endif
+}
+
+static int Region_Contains(struct M68KCodeRegion *region, struct M68KTranslationUnit *unit)
+{
+    uintptr_t code = (uintptr_t)unit->mt_ARMCode;
+
+    return unit->mt_ARMEntryPoint != NULL && code >= region->cr_Base && code < region->cr_Top;
+}
+
+/* Remove all units living in the region and make whole region available again */
+static void Region_Reclaim(struct M68KCodeRegion *region)
+{
+    for (int i=0; i < EMU68_JIT_MAX_UNITS; i++)
+    {
+        if (Region_Contains(region, &Units[i]))
+        {
+            M68K_FreeUnit(&Units[i]);
+            cache_evictions++;
+        }
+    }
+
+    region->cr_Top = region->cr_Base;
+}
+
+/* Make the oldest tenured region the current one, dropping all units it contains */
+static struct M68KCodeRegion *M68K_AdvanceTenured()
+{
+    TenuredCurrent = (TenuredCurrent + 1) % EMU68_JIT_TENURED_REGIONS;
+    Region_Reclaim(&Tenured[TenuredCurrent]);
+
+    return &Tenured[TenuredCurrent];
+}
+
+/*
+    Move code of the unit to a new location. The generated code is position independent,
+    only the exits have to be fixed. Cache maintenance of the new copy is left to the caller.
+*/
+static void M68K_MoveUnit(struct M68KTranslationUnit *unit, uint32_t *dst)
+{
+    struct Node *n;
+
+    DuffCopy(dst, unit->mt_ARMCode, unit->mt_Size / 4);
+
+    unit->mt_ARMCode = dst;
+    unit->mt_ARMEntryPoint = dst;
+#ifdef __aarch64__
+    unit->mt_ARMEntryPoint = (void *)((uintptr_t)dst | 0x0000001000000000);
+#endif
+
+    /* Branch offsets of own exits have changed */
+    for (uint32_t i=0; i < unit->mt_ExitCount; i++)
+    {
+        if (unit->mt_Exits[i].el_Target)
+            M68K_WriteExit(&unit->mt_Exits[i], unit->mt_Exits[i].el_Target);
+    }
+
+    /* Exits of other units have to follow the unit */
+    ForeachNode(&unit->mt_Incoming, n)
+    {
+        struct M68KExitLink *link = (struct M68KExitLink *)n;
+
+        if (link->el_Owner != unit)
+            M68K_PatchExit(link, unit);
+    }
+
+    ICache_Update((uint32_t)(uintptr_t)unit->mt_M68kAddress, (uintptr_t)unit - (uintptr_t)jit_tlsf, unit->mt_ARMEntryPoint);
+
+    /* Unit gets into jump cache again through the hash table, setting its reference bit */
+    JumpCache_Remove((uint32_t)(uintptr_t)unit->mt_M68kAddress);
+}
+
+/*
+    Empty the nursery. Units referenced since they were created, either from ExecutionLoop or
+    through chained exits, are promoted to tenured regions. All other units are removed.
+    Cache maintenance is done once for every tenured region the survivors were copied to.
+*/
+static void M68K_CollectNursery()
+{
+    struct M68KCodeRegion *region = &Tenured[TenuredCurrent];
+    uintptr_t flush_start = region->cr_Top;
+
+    for (int i=0; i < EMU68_JIT_MAX_UNITS; i++)
+    {
+        struct M68KTranslationUnit *unit = &Units[i];
+
+        if (!Region_Contains(&Nursery, unit))
+            continue;
+
+        if (unit->mt_Referenced || !IsListEmpty(&unit->mt_Incoming))
+        {
+            void *dst = Region_Alloc(region, unit->mt_Size);
+
+            if (dst == NULL)
+            {
+                Region_Flush(flush_start, region->cr_Top);
+
+                region = M68K_AdvanceTenured();
+                flush_start = region->cr_Top;
+                dst = Region_Alloc(region, unit->mt_Size);
+            }
+
+            unit->mt_Referenced = 0;
+            M68K_MoveUnit(unit, dst);
+            cache_promotions++;
+        }
+        else
+        {
+            Policy_UnitEvicted(unit->mt_M68kAddress);
+            M68K_FreeUnit(unit);
+            cache_evictions++;
+        }
+    }
+
+    Region_Flush(flush_start, region->cr_Top);
+
+    Nursery.cr_Top = Nursery.cr_Base;
+    cache_collections++;
+
+    M68K_ResetLastPC();
+}
+
+/*
+    Make sure there is a free descriptor and the hash table can take one more unit, then
+    allocate exit links of the new unit. Oldest code is dropped until everything fits.
+*/
+static struct M68KExitLink *M68K_ReserveUnit(uintptr_t exits_length, int speculative)
+{
+    struct M68KExitLink *exits = NULL;
+    int reclaimed = 0;
+
+    /*
+        Workers may neither grow the hash table nor drop any code, the main core could be
+        running it. If there is no room, speculative translation is given up.
+    */
+    if (speculative)
+    {
+        uint32_t slots = (ICacheMask + 1) * ICACHE_BUCKET_SLOTS;
+
+        if (4 * (ICacheUnits + 1) > 3 * slots || IsListEmpty(&FreeUnits))
+            return (void *)-1;
+        if (exits_length == 0)
+            return NULL;
+
+        exits = tlsf_malloc(jit_tlsf, exits_length);
+        return exits ? exits : (void *)-1;
+    }
+
+    while (1)
+    {
+        if (ICache_Reserve() && !IsListEmpty(&FreeUnits))
+        {
+            if (exits_length == 0)
+                break;
+
+            exits = tlsf_malloc(jit_tlsf, exits_length);
+            if (exits != NULL)
+                break;
+        }
+
+        if (reclaimed++ < EMU68_JIT_TENURED_REGIONS)
+            M68K_AdvanceTenured();
+        else
+            Region_Reclaim(&Nursery);
+
+        M68K_ResetLastPC();
+    }
+
+    return exits;
+}
+
+/* Take the cache lock, waiting for event while it is held by another core */
+void M68K_LockCache()
+{
+#ifdef __aarch64__
+    uint32_t tmp;
+
+    asm volatile(
+"       sevl                        \n"
+"1:     wfe                         \n"
+"2:     ldaxr   %w0, [%1]           \n"
+"       cbnz    %w0, 1b             \n"
+"       stxr    %w0, %w2, [%1]      \n"
+"       cbnz    %w0, 2b             \n"
+    :"=&r"(tmp):"r"(&CacheLock),"r"(1):"memory");
+#endif
+}
+
+void M68K_UnlockCache()
+{
+#ifdef __aarch64__
+    asm volatile("stlr wzr, [%0]"::"r"(&CacheLock):"memory");
+#endif
+}
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+/*
+    Make pages holding given range of m68k code read-only. Returns number of pages which were
+    protected now or -1 if at least one of the pages cannot be protected, either because it is
+    written too often or because it is not mapped.
+*/
+static int M68K_ProtectRange(uint16_t *low, uint16_t *high)
+{
+    int count = 0;
+
+    for (uintptr_t page = (uintptr_t)low & ~4095; page < (uintptr_t)high; page += 4096)
+    {
+        uint32_t bit = 1 << ((page >> 12) & 31);
+        uint32_t *word = &ProtectedPages[(page >> 17) & 0x7fff];
+        int ret;
+
+        if (*word & bit)
+            continue;
+        if (PageFaults[(page >> 12) & 4095] >= EMU68_JIT_WP_FAULTS)
+            return -1;
+
+        /* Mark the page first, the main core may fault on it as soon as it is read-only */
+        *word |= bit;
+        asm volatile("dmb ish":::"memory");
+
+        ret = mmu_protect(page, 1);
+        if (ret == 1)
+            count++;
+        else
+        {
+            /* Page was read-only already or is not mapped, leave it alone */
+            *word &= ~bit;
+            if (ret < 0)
+                return -1;
+        }
+    }
+
+    return count;
+}
+
+/*
+    Called from the exception handler when m68k code writes to a page made read-only by
+    M68K_ProtectRange. All units overlapping the page are removed, the page gets writable again
+    and the write is restarted. Returns 0 if the page was not protected by the translator.
+*/
+int M68K_PageWritten(uintptr_t address)
+{
+    uintptr_t page = address & ~4095;
+    uint32_t bit = 1 << ((page >> 12) & 31);
+
+    if (address >> 32 || !(ProtectedPages[page >> 17] & bit))
+        return 0;
+
+    M68K_LockCache();
+
+    cache_smc += M68K_FreeRange(page, page + 4096);
+
+    ProtectedPages[page >> 17] &= ~bit;
+    mmu_protect(page, 0);
+
+    if (PageFaults[(page >> 12) & 4095] < EMU68_JIT_WP_FAULTS)
+        PageFaults[(page >> 12) & 4095]++;
+
+    M68K_ResetLastPC();
+    M68K_UnlockCache();
+
+    return 1;
+}
+#else
+int M68K_PageWritten(uintptr_t address)
+{
+    (void)address;
+    return 0;
+}
+#endif
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+/* Returns non-zero if all pages of the range are protected, the code cannot have changed then */
+static int M68K_RangeProtected(uint16_t *low, uint16_t *high)
+{
+    for (uintptr_t page = (uintptr_t)low & ~4095; page < (uintptr_t)high; page += 4096)
+    {
+        if (!(ProtectedPages[(page >> 17) & 0x7fff] & (1 << ((page >> 12) & 31))))
+            return 0;
+    }
+
+    return 1;
+}
+#endif
+
+/*
+    Full flush of the instruction cache. Instead of being removed, units become suspect. They
+    are unchained, dropped from the jump cache and verified against their fingerprint on the
+    next entry. Units which stay suspect for EMU68_JIT_SUSPECT_EPOCHS flushes are removed.
+    Has to be called with the cache lock held.
+*/
+void M68K_InvalidateAll()
+{
+    struct Node *n, *next;
+
+    ForeachNodeSafe(&LRU, n, next)
+    {
+        struct M68KTranslationUnit *u = (struct M68KTranslationUnit *)((intptr_t)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode));
+
+        if (u->mt_Verify & VERIFY_SUSPECT)
+        {
+            if (FlushEpoch - u->mt_Epoch >= EMU68_JIT_SUSPECT_EPOCHS)
+            {
+                M68K_FreeUnit(u);
+                cache_stale++;
+            }
+            continue;
+        }
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+        if (!u->mt_Verify && M68K_RangeProtected(u->mt_M68kLow, u->mt_M68kHigh))
+            continue;
+#endif
+
+        M68K_UnlinkIncoming(u);
+        u->mt_Verify |= VERIFY_SUSPECT;
+        u->mt_Epoch = FlushEpoch;
+    }
+
+    FlushEpoch++;
+    memset(JumpCache, 0xff, sizeof(struct M68KJumpCacheEntry) * JCACHE_SIZE);
+    M68K_ClearReturnStack();
+}
+
+/* Chain exits waiting for units which were created by the workers since the last call */
+static void M68K_LinkDeferred()
+{
+    for (uint32_t i=0; i < DeferredCount; i++)
+    {
+        struct M68KTranslationUnit *unit = &Units[DeferredLinks[i]];
+
+        /* Unit could have been removed in the meantime */
+        if (unit->mt_ARMEntryPoint != NULL && unit->mt_M68kAddress == DeferredAddress[i])
+            M68K_LinkPending(unit);
+    }
+
+    DeferredCount = 0;
+}
+
+/*
+    Queue targets of direct exits of the unit which are not in the cache yet. Translation
+    workers pick them up while the main core continues.
+*/
+static void M68K_QueueSpeculation()
+{
+#if defined(__aarch64__) && EMU68_JIT_WORKERS
+    int queued = 0;
+
+    for (uint32_t i=0; i < exit_count; i++)
+    {
+        uint32_t next = (SpecHead + 1) & (EMU68_JIT_SPEC_QUEUE - 1);
+
+        if (next == SpecTail)
+            break;
+        if (exit_type[i] != EXIT_DIRECT || M68K_LookupUnit(exit_target[i]))
+            continue;
+
+        SpecQueue[SpecHead] = exit_target[i];
+        SpecHead = next;
+        queued = 1;
+    }
 
-    If th sums are not same, the block is removed form LRU cache and hashtable and memory
-    is released.
+    if (queued)
+        asm volatile("sev");
+#endif
+}
 
-    The function returns poitner to verified unit or NULL if the unit changed
+/*
+    Translate m68k code at given address and put the new unit into the cache. Units of tier 1
+    are short and count their uses, once they get hot they are translated again at tier 2.
+    Speculative units are made by translation workers. They fail with NULL instead of making
+    room in the cache and leave chaining of other units' exits to the main core.
 */
-struct M68KTranslationUnit *M68K_VerifyUnit(struct M68KTranslationUnit *unit)
+/*
+    PC side table of a unit. For every m68k instruction it holds the offset of its host code
+    and its address, both as deltas to the previous instruction, starting from offset 0 and
+    the unit's m68k address. The usual entry is two bytes: ARM instructions and signed m68k
+    words. Entries not fitting are escaped with -128 in the second byte and followed by full
+    offset and address, four bytes each, little endian. When the registers holding modified
+    CC, FPCR and FPSR at the start of an instruction differ from the previous one, its entry is
+    preceded by four bytes: CC register, -127, FPCR and FPSR registers. With map NULL only size
+    is computed.
+*/
+#define PCMAP_ESCAPE    -128
+#define PCMAP_STATE     -127
+
+static uint32_t M68K_EncodePCMap(uint8_t *map)
 {
-    struct MD5 m;
+    uint32_t size = 0;
+    uint32_t arm = 0;
+    uint32_t m68k = (uint32_t)(uintptr_t)local_state[0].mls_M68kPtr;
+    uint8_t modified[3] = { 0xff, 0xff, 0xff };
 
-    if (unit)
+    for (uint32_t i=0; i < insn_count; i++)
     {
-        m = CalcMD5(unit->mt_M68kLow, unit->mt_M68kHigh);
+        uint32_t arm_delta = local_state[i].mls_ARMOffset - arm;
+        int32_t m68k_delta = (int32_t)((uint32_t)(uintptr_t)local_state[i].mls_M68kPtr - m68k) / 2;
+
+        arm = local_state[i].mls_ARMOffset;
+        m68k = (uint32_t)(uintptr_t)local_state[i].mls_M68kPtr;
 
-        if (m.a != unit->mt_MD5.a ||
-            m.b != unit->mt_MD5.b ||
-            m.c != unit->mt_MD5.c ||
-            m.d != unit->mt_MD5.d)
+        if (modified[0] != local_state[i].mls_Modified[0] || modified[1] != local_state[i].mls_Modified[1] ||
+            modified[2] != local_state[i].mls_Modified[2])
         {
-            REMOVE(&unit->mt_LRUNode);
-            REMOVE(&unit->mt_HashNode);
-            tlsf_free(jit_tlsf, unit);
-            unit = NULL;
+            for (int r=0; r < 3; r++)
+                modified[r] = local_state[i].mls_Modified[r];
+            if (map)
+            {
+                map[size] = modified[0];
+                map[size + 1] = (uint8_t)PCMAP_STATE;
+                map[size + 2] = modified[1];
+                map[size + 3] = modified[2];
+            }
+            size += 4;
+        }
+
+        if (arm_delta < 256 && m68k_delta > PCMAP_STATE && m68k_delta < 128)
+        {
+            if (map)
+            {
+                map[size] = arm_delta;
+                map[size + 1] = (uint8_t)m68k_delta;
+            }
+            size += 2;
+        }
+        else
+        {
+            if (map)
+            {
+                map[size] = 0;
+                map[size + 1] = (uint8_t)PCMAP_ESCAPE;
+                for (int b=0; b < 4; b++)
+                {
+                    map[size + 2 + b] = arm >> (8 * b);
+                    map[size + 6 + b] = m68k >> (8 * b);
+                }
+            }
+            size += 10;
         }
     }
 
-    return unit;
+    return size;
 }
 
-/*
-    Get M68K code unit from the instruction cache. Return NULL if code was not found and needs to be
-    translated first.
-
-    If the code was found, update its position in the LRU cache.
-*/
-struct M68KTranslationUnit *M68K_GetTranslationUnit(uint16_t *m68kcodeptr)
+/* Unit whose host code contains arm_pc, NULL if there is none */
+static struct M68KTranslationUnit *M68K_FindUnitByARM(uintptr_t arm_pc)
 {
-    struct M68KTranslationUnit *unit = NULL, *n;
-    uintptr_t hash = (uintptr_t)m68kcodeptr;
-    uint16_t *orig_m68kcodeptr = m68kcodeptr;
-    
-    m68k_low = m68kcodeptr;
-    m68k_high = m68kcodeptr;
+#ifdef __aarch64__
+    /* Code is executed from its alias */
+    arm_pc &= ~(uintptr_t)0x0000001000000000;
+#endif
 
-    /* Get 16-bit has from the pointer to m68k code */
-    hash = (hash ^ (hash >> 16)) & 0xffff;
+    for (int i=0; i < EMU68_JIT_MAX_UNITS; i++)
+    {
+        struct M68KTranslationUnit *unit = &Units[i];
 
-    if (debug > 2)
-        kprintf("[ICache] GetTranslationUnit(%08x)\n[ICache] Hash: 0x%04x\n", (void*)m68kcodeptr, (int)hash);
+        if (unit->mt_ARMEntryPoint && arm_pc - (uintptr_t)unit->mt_ARMCode < unit->mt_Size)
+            return unit;
+    }
 
-    /* Find entry with correct address */
-    ForeachNode(&ICache[hash], n)
+    return NULL;
+}
+
+#ifdef __aarch64__
+/*
+    Sum up changes of m68k address registers made by host code between from and to: writeback
+    of loads and stores, (An)+ and -(An), and additions of immediates to the register itself.
+    Code of one m68k instruction is scanned as if it was straight-line.
+*/
+static void M68K_GetWriteback(uint32_t *code, uint32_t from, uint32_t to, int32_t *adjust)
+{
+    for (uint32_t i=from; i < to; i++)
     {
-        if (n->mt_M68kAddress == m68kcodeptr)
+        uint32_t insn = INSN_TO_LE(code[i]);
+        uint8_t rn = (insn >> 5) & 31;
+        int32_t delta;
+
+        /* Load/store register, immediate pre- or post-index */
+        if ((insn & 0x3b200400) == 0x38000400)
+            delta = ((int32_t)(insn << 11)) >> 23;
+        /* Load/store pair, pre- or post-index */
+        else if ((insn & 0x3a800000) == 0x28800000)
+            delta = (((int32_t)(insn << 10)) >> 25) * ((insn & (1 << 26)) ? 4 << (insn >> 30) : 4 << (insn >> 31));
+        /* ADD/SUB (immediate) with Rd == Rn */
+        else if ((insn & 0x1f000000) == 0x11000000 && rn == (insn & 31))
         {
-            /* Unit found? Move it to the front of LRU list */
-            unit = n;
+            delta = ((insn >> 10) & 0xfff) << ((insn & (1 << 22)) ? 12 : 0);
+            if (insn & (1 << 30))
+                delta = -delta;
+        }
+        else
+            continue;
+
+        if (rn >= REG_A0 && rn < REG_A0 + 5)
+            adjust[rn - REG_A0] += delta;
+        else if (rn >= REG_A5 && rn <= REG_A7)
+            adjust[5 + rn - REG_A5] += delta;
+    }
+}
+#endif
+
+/*
+    Find the m68k instruction which host code at arm_pc belongs to. Returns 0 if arm_pc is
+    not within translated code, otherwise the address of the instruction is put in m68k_pc.
+    If modified is not NULL, it receives the registers which held CC, FPCR and FPSR not yet
+    written back when the instruction started, 0xff for those which were up to date. If
+    adjust is not NULL, it receives the amounts A0-A7 were changed by host code of the
+    instruction before arm_pc, so that the instruction can be restarted.
+*/
+int M68K_RecoverPC(uintptr_t arm_pc, uint32_t *m68k_pc, uint8_t *modified, int32_t *adjust)
+{
+    struct M68KTranslationUnit *unit = M68K_FindUnitByARM(arm_pc);
+    uint8_t *map;
+    uint32_t offset;
+    uint32_t arm = 0;
+    uint32_t start = 0;
+    uint32_t m68k;
+    uint8_t state[3] = { 0xff, 0xff, 0xff };
 
-            struct Node *this = &unit->mt_LRUNode;
+    if (unit == NULL)
+        return 0;
 
 #ifdef __aarch64__
-            /* Correct unit found. Preload ICache */
-            //asm volatile ("prfm plil1keep, [%0]"::"r"(unit->mt_ARMEntryPoint));
+    arm_pc &= ~(uintptr_t)0x0000001000000000;
 #endif
-            if (1)
-            {
-                // Update LRU for least *frequently* used strategy
-                if (this->ln_Pred->ln_Pred) {
-                    struct Node *pred = this->ln_Pred;
-                    struct Node *succ = this->ln_Succ;
-
-                    this->ln_Pred = pred->ln_Pred;
-                    this->ln_Succ = pred;
-                    this->ln_Pred->ln_Succ = this;
-                    pred->ln_Pred = this;
-                    pred->ln_Succ = succ;
-                    succ->ln_Pred = pred;
-                }
-            }
-            else
+    offset = (arm_pc - (uintptr_t)unit->mt_ARMCode) / 4;
+    map = unit->mt_PCMap;
+    m68k = (uint32_t)(uintptr_t)unit->mt_M68kAddress;
+    *m68k_pc = m68k;
+    if (modified)
+        memcpy(modified, state, 3);
+
+    for (uint32_t i=0; i < unit->mt_M68kInsnCnt; i++)
+    {
+        if ((int8_t)map[1] == PCMAP_STATE)
+        {
+            state[0] = map[0];
+            state[1] = map[2];
+            state[2] = map[3];
+            map += 4;
+        }
+
+        if ((int8_t)map[1] == PCMAP_ESCAPE)
+        {
+            arm = m68k = 0;
+            for (int b=0; b < 4; b++)
             {
-                // Update LRU for least *recently* used strategy
-                REMOVE(&unit->mt_LRUNode);
-                ADDHEAD(&LRU, &unit->mt_LRUNode);
+                arm |= map[2 + b] << (8 * b);
+                m68k |= map[6 + b] << (8 * b);
             }
-
-            return unit;
+            map += 10;
+        }
+        else
+        {
+            arm += map[0];
+            m68k += 2 * (int8_t)map[1];
+            map += 2;
         }
+
+        if (arm > offset)
+            break;
+
+        *m68k_pc = m68k;
+        start = arm;
+        if (modified)
+            memcpy(modified, state, 3);
     }
 
-    if (unit == NULL)
+    if (adjust)
     {
-        uintptr_t line_length = M68K_Translate(m68kcodeptr);
-        uintptr_t arm_insn_count = line_length/4 - 1;
-
+        for (int r=0; r < 8; r++)
+            adjust[r] = 0;
 #ifdef __aarch64__
-        uintptr_t unit_length = (line_length + 63 + sizeof(struct M68KTranslationUnit)) & ~63;
-#else
-        uintptr_t unit_length = (line_length + 31 + sizeof(struct M68KTranslationUnit)) & ~31;
+        M68K_GetWriteback(unit->mt_ARMCode, start, offset, adjust);
+#endif
+    }
+
+    return 1;
+}
+
+static struct M68KTranslationUnit *M68K_CreateUnit(uint16_t *m68kcodeptr, int tier, int speculative)
+{
+    struct M68KTranslationUnit *unit;
+    uint16_t *orig_m68kcodeptr = m68kcodeptr;
+
+    m68k_low = m68kcodeptr;
+    m68k_high = m68kcodeptr;
+
+    uintptr_t line_length = M68K_Translate(m68kcodeptr, tier);
+    int verify = 0;
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+    /*
+        The main core could write the code while a worker translates it. If any page had to be
+        protected only now, the code is translated again, this time from protected memory.
+    */
+    if (speculative)
+    {
+        int protected = M68K_ProtectRange(m68k_low, m68k_high);
+
+        if (protected < 0)
+            return NULL;
+
+        if (protected > 0)
+        {
+            m68k_low = m68kcodeptr;
+            m68k_high = m68kcodeptr;
+            line_length = M68K_Translate(m68kcodeptr, tier);
+
+            if (M68K_ProtectRange(m68k_low, m68k_high) != 0)
+                return NULL;
+        }
+    }
+    else if (M68K_ProtectRange(m68k_low, m68k_high) < 0)
+        verify = 1;
 #endif
-        do {
+
+    uintptr_t arm_insn_count = line_length/4 - 1;
+    uint32_t page_count = M68K_PageLinks(m68k_low, m68k_high);
+    uint32_t pcmap_length = M68K_EncodePCMap(NULL);
+    uintptr_t exits_length = exit_count * sizeof(struct M68KExitLink) + page_count * sizeof(struct M68KPageLink) + pcmap_length;
+    struct M68KExitLink *exits = M68K_ReserveUnit(exits_length, speculative);
+    uint32_t *code;
+
+    if (exits == (void *)-1)
+        return NULL;
+
 #ifdef __aarch64__
-            unit = tlsf_malloc_aligned(jit_tlsf, unit_length, 64);
+    uintptr_t code_length = (line_length + 63) & ~63;
 #else
-            unit = tlsf_malloc_aligned(jit_tlsf, unit_length, 32);
+    uintptr_t code_length = (line_length + 31) & ~31;
 #endif
-            if (unit == NULL)
-            {
-                #ifndef __aarch64__
-                extern uint32_t last_PC;
-                #endif
-                struct Node *n = REMTAIL(&LRU);
-                void *ptr = (char *)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode);
-                REMOVE((struct Node *)ptr);
-                kprintf("[ICache] Requested block was %d\n", unit_length);
-                kprintf("[ICache] Run out of cache. Removing least recently used cache line node @ %p\n", ptr);
-                tlsf_free(jit_tlsf, ptr);
-                #ifdef __aarch64__
-                asm volatile("msr tpidr_el1, %0"::"r"(0xffffffff));
-                #else
-                last_PC = 0xffffffff;
-                #endif
-            }
-        } while(unit == NULL);
+    code = Region_Alloc(&Nursery, code_length);
+    if (code == NULL && speculative)
+    {
+        if (exits)
+            tlsf_free(jit_tlsf, exits);
+        return NULL;
+    }
+    else if (code == NULL)
+    {
+        M68K_CollectNursery();
+        code = Region_Alloc(&Nursery, code_length);
+    }
 
-        unit->mt_ARMEntryPoint = &unit->mt_ARMCode[0];
+    unit = (struct M68KTranslationUnit *)REMHEAD(&FreeUnits);
+
+    unit->mt_ARMCode = code;
+    unit->mt_ARMEntryPoint = code;
 #ifdef __aarch64__
-        unit->mt_ARMEntryPoint = (void *)((uintptr_t)unit->mt_ARMEntryPoint | 0x0000001000000000);
+    unit->mt_ARMEntryPoint = (void *)((uintptr_t)code | 0x0000001000000000);
 #endif
-        unit->mt_M68kInsnCnt = insn_count;
-        unit->mt_ARMInsnCnt = arm_insn_count;
-        unit->mt_UseCount = 0;
-        unit->mt_FetchCount = 0;
-        unit->mt_M68kAddress = orig_m68kcodeptr;
-        unit->mt_M68kLow = m68k_low;
-        unit->mt_M68kHigh = m68k_high;
-        unit->mt_MD5 = CalcMD5(m68k_low, m68k_high);
-        unit->mt_PrologueSize = prologue_size;
-        unit->mt_EpilogueSize = epilogue_size;
-        unit->mt_Conditionals = conditionals_count;
-        DuffCopy(&unit->mt_ARMCode[0], temporary_arm_code, line_length/4);
+    unit->mt_M68kInsnCnt = insn_count;
+    unit->mt_ARMInsnCnt = arm_insn_count;
+    unit->mt_OptimizedCnt = optimized_count;
+    Policy_UnitCreated(orig_m68kcodeptr, insn_count, arm_insn_count);
+    unit->mt_UseCount = 0;
+    unit->mt_FetchCount = 0;
+    unit->mt_M68kAddress = orig_m68kcodeptr;
+    unit->mt_M68kLow = m68k_low;
+    unit->mt_M68kHigh = m68k_high;
+    Fingerprint_Calc(&unit->mt_Fingerprint, m68k_low, m68k_high);
+    unit->mt_PrologueSize = prologue_size;
+    unit->mt_EpilogueSize = epilogue_size;
+    unit->mt_Conditionals = conditionals_count;
+    unit->mt_ExitCount = exit_count;
+    unit->mt_Size = code_length;
+    unit->mt_Referenced = 0;
+    unit->mt_Tier = tier;
+    unit->mt_Verify = verify;
+    unit->mt_HotCount = EMU68_JIT_TIER_THRESHOLD;
+    unit->mt_Exits = exits;
+    unit->mt_Pages = (struct M68KPageLink *)&exits[exit_count];
+    unit->mt_PageCount = page_count;
+    unit->mt_PCMap = (uint8_t *)&unit->mt_Pages[page_count];
+    M68K_EncodePCMap(unit->mt_PCMap);
+    NEWLIST(&unit->mt_Incoming);
+    for (uint32_t i=0; i < exit_count; i++)
+    {
+        unit->mt_Exits[i].el_Owner = unit;
+        unit->mt_Exits[i].el_Target = NULL;
+        unit->mt_Exits[i].el_M68kTarget = exit_target[i];
+        unit->mt_Exits[i].el_Offset = exit_offset[i];
+        unit->mt_Exits[i].el_Type = exit_type[i];
+        unit->mt_Exits[i].el_Count = 0;
+    }
+    DuffCopy(unit->mt_ARMCode, temporary_arm_code, line_length/4);
+    if (indirect_header)
+        unit->mt_ARMCode[indirect_header + 1] = unit - Units;
+    if (tier_literal)
+    {
+        union {
+            uint64_t u64;
+            uint32_t u32[2];
+        } u;
+
+        u.u64 = (uintptr_t)unit;
+        unit->mt_ARMCode[tier_literal] = BE32(u.u32[0]);
+        unit->mt_ARMCode[tier_literal + 1] = BE32(u.u32[1]);
+    }
 
-        ADDHEAD(&LRU, &unit->mt_LRUNode);
-        ADDHEAD(&ICache[hash], &unit->mt_HashNode);
+    ADDHEAD(&LRU, &unit->mt_LRUNode);
+    PageIndex_Insert(unit);
+    cache_translations++;
 
-        if (debug) {
-            struct MD5 m = unit->mt_MD5;
-            kprintf("[ICache]   Block checksum: %08x%08x%08x%08x\n", m.a, m.b, m.c, m.d);
-            kprintf("[ICache]   ARM code at %p\n", unit->mt_ARMEntryPoint);
-        }
+    if (debug) {
+        uint32_t *h = unit->mt_Fingerprint.fp_Hash;
+        kprintf("[ICache]   Block %s fingerprint: %08x%08x%08x%08x\n", Fingerprint_Name(), h[0], h[1], h[2], h[3]);
+        kprintf("[ICache]   ARM code at %p\n", unit->mt_ARMEntryPoint);
+    }
 
-        arm_flush_cache((uintptr_t)&unit->mt_ARMCode, 4 * unit->mt_ARMInsnCnt);
-        arm_icache_invalidate((intptr_t)unit->mt_ARMEntryPoint, 4 * unit->mt_ARMInsnCnt);
+    /* Code has to be complete before the unit becomes visible in the hash table */
+    M68K_LinkExits(unit);
 
-        if (debug)
+    arm_flush_cache((uintptr_t)unit->mt_ARMCode, 4 * unit->mt_ARMInsnCnt);
+    arm_icache_invalidate((intptr_t)unit->mt_ARMEntryPoint, 4 * unit->mt_ARMInsnCnt);
+
+    ICache_Insert(ICache, ICacheMask, (uint32_t)(uintptr_t)orig_m68kcodeptr, (uintptr_t)unit - (uintptr_t)jit_tlsf, unit->mt_ARMEntryPoint);
+    ICacheUnits++;
+
+    if (speculative)
+    {
+        DeferredLinks[DeferredCount] = unit - Units;
+        DeferredAddress[DeferredCount] = orig_m68kcodeptr;
+        DeferredCount++;
+        cache_speculations++;
+    }
+    else
+    {
+        M68K_LinkPending(unit);
+        M68K_QueueSpeculation();
+    }
+
+    if (debug)
+    {
+        kprintf("-- ARM Code dump --\n");
+        for (uint32_t i=0; i < unit->mt_ARMInsnCnt; i++)
         {
-            kprintf("-- ARM Code dump --\n");
-            for (uint32_t i=0; i < unit->mt_ARMInsnCnt; i++)
-            {
-                if ((i % 5) == 0)
-                    kprintf("   ");
-                uint32_t insn = LE32(unit->mt_ARMCode[i]);
-                kprintf(" %02x %02x %02x %02x", insn & 0xff, (insn >> 8) & 0xff, (insn >> 16) & 0xff, (insn >> 24) & 0xff);
-                if ((i % 5) == 4)
-                    kprintf("\n");
-            }
-            if (unit->mt_ARMInsnCnt % 5 != 0)
+            if ((i % 5) == 0)
+                kprintf("   ");
+            uint32_t insn = LE32(unit->mt_ARMCode[i]);
+            kprintf(" %02x %02x %02x %02x", insn & 0xff, (insn >> 8) & 0xff, (insn >> 16) & 0xff, (insn >> 24) & 0xff);
+            if ((i % 5) == 4)
                 kprintf("\n");
-            if (debug > 3)
+        }
+        if (unit->mt_ARMInsnCnt % 5 != 0)
+            kprintf("\n");
+        if (debug > 3)
+        {
+            kprintf("\n-- Local State --\n");
+            for (unsigned i=0; i < insn_count; i++)
             {
-                kprintf("\n-- Local State --\n");
-                for (unsigned i=0; i < insn_count; i++)
-                {
-                    kprintf("    %p -> %08x", local_state[i].mls_M68kPtr, local_state[i].mls_ARMOffset);
-                    for (int r=0; r < 16; r++) {
-                        if (local_state[i].mls_RegMap[r] != 0xff) {
-                            kprintf(" %c%d=r%d%s", r < 8 ? 'D' : 'A', r % 8, local_state[i].mls_RegMap[r] & 15,
-                            local_state[i].mls_RegMap[r] & 0x80 ? "!":"");
-                        }
+                kprintf("    %p -> %08x", local_state[i].mls_M68kPtr, local_state[i].mls_ARMOffset);
+                for (int r=0; r < 16; r++) {
+                    if (local_state[i].mls_RegMap[r] != 0xff) {
+                        kprintf(" %c%d=r%d%s", r < 8 ? 'D' : 'A', r % 8, local_state[i].mls_RegMap[r] & 15,
+                        local_state[i].mls_RegMap[r] & 0x80 ? "!":"");
                     }
-                    kprintf(" PC_Rel=%d\n", local_state[i].mls_PCRel);
                 }
+                kprintf(" PC_Rel=%d\n", local_state[i].mls_PCRel);
             }
         }
     }
 
+    return unit;
+}
+
+/*
+    Check whether the fall-through path of a conditional branch was found hot during profiling
+    of the unit at tier 1. If so, translator keeps following it and the taken branch becomes
+    the side exit.
+*/
+int M68K_IsFallThroughHot(uint16_t *ptr)
+{
+    for (uint32_t i=0; i < hot_fallthrough_count; i++)
+    {
+        if (hot_fallthrough[i] == ptr)
+            return 1;
+    }
+
+    return 0;
+}
+
+#ifdef __aarch64__
+/*
+    Called from TierUp when use counter of a tier 1 unit expires. The unit is translated again
+    at tier 2 and replaces the old one. Exits of other units chained to the old unit are moved
+    to the new one. No translated code runs meanwhile, so the swap is atomic for the m68k side.
+    Returns entry point of the new unit.
+*/
+void *M68K_TierUp(struct M68KTranslationUnit *unit)
+{
+    uint16_t *m68kcodeptr = unit->mt_M68kAddress;
+    struct List incoming;
+    struct Node *n;
+    void *entry;
+    uint32_t exits_taken = 0;
+
+    M68K_LockCache();
+    M68K_ReleaseRetired();
+    M68K_LinkDeferred();
+
+    /* Side exits taken in most of the runs become the main path of tier 2 unit */
+    hot_fallthrough_count = 0;
+    for (uint32_t i=0; i < unit->mt_ExitCount; i++)
+    {
+        exits_taken += unit->mt_Exits[i].el_Count;
+        if (unit->mt_Exits[i].el_Count > EMU68_JIT_TIER_THRESHOLD / 2)
+            hot_fallthrough[hot_fallthrough_count++] = unit->mt_Exits[i].el_M68kTarget;
+    }
+    Policy_UnitHot(m68kcodeptr, exits_taken);
+
+    NEWLIST(&incoming);
+    while ((n = REMHEAD(&unit->mt_Incoming)))
+        ADDTAIL(&incoming, n);
+
+    M68K_FreeUnit(unit);
+    unit = M68K_CreateUnit(m68kcodeptr, 2, 0);
+    hot_fallthrough_count = 0;
+
+    while ((n = REMHEAD(&incoming)))
+    {
+        ADDHEAD(&unit->mt_Incoming, n);
+        M68K_PatchExit((struct M68KExitLink *)n, unit);
+    }
+
+    if (!unit->mt_Verify)
+    {
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_ARMEntryPoint = unit->mt_ARMEntryPoint;
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_Unit = (uintptr_t)unit - (uintptr_t)jit_tlsf;
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_M68kPC = (uint32_t)(uintptr_t)m68kcodeptr;
+    }
+    M68K_ResetLastPC();
+
+    cache_tierups++;
+    entry = unit->mt_ARMEntryPoint;
+
+    M68K_UnlockCache();
+
+    return entry;
+}
+#endif
+
+/*
+    Get M68K code unit from the instruction cache. Return NULL if code was not found and needs to be
+    translated first.
+
+    If the code was found, its reference bit is set. Referenced units survive the next collection
+    of the nursery.
+*/
+struct M68KTranslationUnit *M68K_GetTranslationUnit(uint16_t *m68kcodeptr)
+{
+    struct M68KTranslationUnit *unit = NULL;
+
+    if (debug > 2)
+        kprintf("[ICache] GetTranslationUnit(%08x)\n[ICache] Hash: 0x%04x\n", (void*)m68kcodeptr, (int)(ICACHE_HASH(m68kcodeptr) & ICacheMask));
+
+    M68K_LockCache();
+    M68K_ReleaseRetired();
+    M68K_LinkDeferred();
+
+    /* Find entry with correct address */
+    unit = M68K_FindTranslationUnit(m68kcodeptr);
+
+    /* Units left over from a full flush are kept as long as their code did not change */
+    if (unit && (unit->mt_Verify & VERIFY_SUSPECT))
+    {
+        if (Fingerprint_Check(&unit->mt_Fingerprint, unit->mt_M68kLow, unit->mt_M68kHigh))
+            M68K_ReviveUnit(unit);
+        else
+        {
+            M68K_FreeUnit(unit);
+            unit = NULL;
+        }
+    }
+
+    if (unit == NULL)
+        unit = M68K_CreateUnit(m68kcodeptr, 1, 0);
+
+    /* Next dispatch of this unit will be resolved by the jump cache */
+    if (!unit->mt_Verify)
+    {
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_ARMEntryPoint = unit->mt_ARMEntryPoint;
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_Unit = (uintptr_t)unit - (uintptr_t)jit_tlsf;
+        JumpCache[JCACHE_INDEX(m68kcodeptr)].jc_M68kPC = (uint32_t)(uintptr_t)m68kcodeptr;
+    }
+
+    M68K_UnlockCache();
+
 #ifdef __aarch64__
     //asm volatile ("prfm plil1keep, [%0]"::"r"(unit->mt_ARMEntryPoint));
 #endif
@@ -688,8 +2647,109 @@ struct M68KTranslationUnit *M68K_GetTranslationUnit(uint16_t *m68kcodeptr)
     return unit;
 }
 
+/*
+    Translate unit into the cache before it is used for the first time. Preloaded units which
+    are not referenced until the next collection of the nursery are dropped like any other.
+    Returns non-zero if a new unit was created.
+*/
+int M68K_PreloadUnit(uint16_t *m68kcodeptr)
+{
+    int created = 0;
+
+    M68K_LockCache();
+
+    if (M68K_LookupUnit(m68kcodeptr) == NULL)
+        created = M68K_CreateUnit(m68kcodeptr, 1, 0) != NULL;
+
+    M68K_UnlockCache();
+
+    return created;
+}
+
+/*
+    Leave translation of units found at boot to the workers. The list is freed once all of its
+    entries are done. Returns zero if there are no workers, the caller has to translate the
+    units itself then.
+*/
+int M68K_QueuePreload(uint16_t **list, uint32_t count)
+{
+#if defined(__aarch64__) && EMU68_JIT_WORKERS
+    M68K_LockCache();
+
+    PreloadList = list;
+    PreloadCount = count;
+    PreloadNext = 0;
+
+    M68K_UnlockCache();
+
+    asm volatile("sev");
+
+    return 1;
+#else
+    (void)list;
+    (void)count;
+
+    return 0;
+#endif
+}
+
+/*
+    Main loop of a translation worker running on a secondary core. Queued addresses are
+    translated into the cache as long as there is room for them without dropping any code.
+*/
+void M68K_TranslationWorker()
+{
+    while (1)
+    {
+        uint16_t *m68kcodeptr = NULL;
+        int preload = 0;
+
+        M68K_LockCache();
+
+        while (m68kcodeptr == NULL && SpecTail != SpecHead && DeferredCount < EMU68_JIT_SPEC_QUEUE)
+        {
+            m68kcodeptr = SpecQueue[SpecTail];
+            SpecTail = (SpecTail + 1) & (EMU68_JIT_SPEC_QUEUE - 1);
+
+            if (M68K_LookupUnit(m68kcodeptr))
+                m68kcodeptr = NULL;
+        }
+
+        /* Speculation comes first, it follows the code which runs right now */
+        while (m68kcodeptr == NULL && PreloadNext < PreloadCount && DeferredCount < EMU68_JIT_SPEC_QUEUE)
+        {
+            m68kcodeptr = PreloadList[PreloadNext++];
+            preload = 1;
+
+            if (M68K_LookupUnit(m68kcodeptr))
+                m68kcodeptr = NULL;
+        }
+
+        /* No room left in the cache, the rest of the list is translated on first use */
+        if (m68kcodeptr && M68K_CreateUnit(m68kcodeptr, 1, 1) == NULL && preload)
+            PreloadNext = PreloadCount;
+
+        if (PreloadList && PreloadNext == PreloadCount)
+        {
+            tlsf_free(tlsf, PreloadList);
+            PreloadList = NULL;
+            PreloadCount = 0;
+            PreloadNext = 0;
+        }
+
+        M68K_UnlockCache();
+
+        /* Nothing to do, sleep until the main core queues more work */
+        if (m68kcodeptr == NULL)
+            asm volatile("wfe");
+    }
+}
+
 void M68K_InitializeCache()
 {
+    of_node_t *chosen = dt_find_node("/chosen");
+    of_property_t *bootargs = chosen ? dt_find_property(chosen, "bootargs") : NULL;
+
     kprintf("[ICache] Initializing caches\n");
 
 #ifndef __aarch64__
@@ -702,13 +2762,69 @@ void M68K_InitializeCache()
     NEWLIST(&LRU);
 
     kprintf("[ICache] Setting up ICache\n");
-    ICache = tlsf_malloc(tlsf, sizeof(struct List) * 65536);
+    ICache = tlsf_malloc_aligned(tlsf, sizeof(struct M68KICacheBucket) * ICACHE_INITIAL_BUCKETS, 64);
+    ICacheMask = ICACHE_INITIAL_BUCKETS - 1;
+    ICacheUnits = 0;
     temporary_arm_code = tlsf_malloc(jit_tlsf, EMU68_M68K_INSN_DEPTH * 16 * 64);
     kprintf("[ICache] Temporary code at %p\n", temporary_arm_code);
     local_state = tlsf_malloc(tlsf, sizeof(struct M68KLocalState)*EMU68_M68K_INSN_DEPTH*2);
+#if defined(__aarch64__) && EMU68_JIT_IR
+    IR_Init();
+#endif
     kprintf("[ICache] ICache array at %p\n", ICache);
-    for (int i=0; i < 65536; i++)
-        NEWLIST(&ICache[i]);
+    memset(ICache, 0xff, sizeof(struct M68KICacheBucket) * ICACHE_INITIAL_BUCKETS);
+
+    kprintf("[ICache] Setting up jump cache\n");
+    JumpCache = tlsf_malloc_aligned(tlsf, sizeof(struct M68KJumpCacheEntry) * JCACHE_SIZE, 64);
+    memset(JumpCache, 0xff, sizeof(struct M68KJumpCacheEntry) * JCACHE_SIZE);
+
+    NEWLIST(&IdleExits);
+
+    kprintf("[ICache] Setting up page index\n");
+    PageUnits = tlsf_malloc(tlsf, sizeof(struct List) * PAGE_HASH_SIZE);
+    for (int i=0; i < PAGE_HASH_SIZE; i++)
+        NEWLIST(&PageUnits[i]);
+    NEWLIST(&WideUnits);
+
+    kprintf("[ICache] Setting up unit descriptors\n");
+    NEWLIST(&FreeUnits);
+    NEWLIST(&RetiredUnits);
+    Units = tlsf_malloc(jit_tlsf, sizeof(struct M68KTranslationUnit) * EMU68_JIT_MAX_UNITS);
+    for (int i=EMU68_JIT_MAX_UNITS - 1; i >= 0; i--)
+    {
+        Units[i].mt_ARMEntryPoint = NULL;
+        Units[i].mt_ARMCode = NULL;
+        ADDHEAD(&FreeUnits, &Units[i].mt_LRUNode);
+    }
+    kprintf("[ICache] Descriptors at %p\n", Units);
+
+    kprintf("[ICache] Setting up code regions\n");
+    Nursery.cr_Base = (uintptr_t)tlsf_malloc_aligned(jit_tlsf, EMU68_JIT_NURSERY_SIZE, 64);
+    Nursery.cr_Top = Nursery.cr_Base;
+    Nursery.cr_End = Nursery.cr_Base + EMU68_JIT_NURSERY_SIZE;
+    kprintf("[ICache] Nursery at %p\n", (void *)Nursery.cr_Base);
+    for (int i=0; i < EMU68_JIT_TENURED_REGIONS; i++)
+    {
+        Tenured[i].cr_Base = (uintptr_t)tlsf_malloc_aligned(jit_tlsf, EMU68_JIT_TENURED_SIZE, 64);
+        Tenured[i].cr_Top = Tenured[i].cr_Base;
+        Tenured[i].cr_End = Tenured[i].cr_Base + EMU68_JIT_TENURED_SIZE;
+        kprintf("[ICache] Tenured region %d at %p\n", i, (void *)Tenured[i].cr_Base);
+    }
+    TenuredCurrent = 0;
+
+#if defined(__aarch64__) && EMU68_JIT_WRITE_PROTECT
+    kprintf("[ICache] Setting up page protection\n");
+    ProtectedPages = tlsf_malloc(tlsf, 32768 * sizeof(uint32_t));
+    bzero(ProtectedPages, 32768 * sizeof(uint32_t));
+#endif
+
+    Fingerprint_Init(bootargs ? bootargs->op_value : NULL);
+    Policy_Init(bootargs ? bootargs->op_value : NULL);
+
+    kprintf("[ICache] Setting up pending exits\n");
+    PendingExits = tlsf_malloc(tlsf, sizeof(struct List) * EXIT_HASH_SIZE);
+    for (int i=0; i < EXIT_HASH_SIZE; i++)
+        NEWLIST(&PendingExits[i]);
 }
 
 void M68K_DumpStats()
@@ -720,6 +2836,10 @@ void M68K_DumpStats()
     unsigned m68k_count = 0;
     unsigned arm_count = 0;
     unsigned total_arm_count = 0;
+    unsigned optimized_cnt = 0;
+    unsigned exit_cnt = 0;
+    unsigned chained_cnt = 0;
+    uintptr_t m68k_range = 0;
 
     if (debug)
         kprintf("[ICache] Listing translation units:\n");
@@ -728,17 +2848,33 @@ void M68K_DumpStats()
         cnt++;
         unit = (void *)((char *)n - __builtin_offsetof(struct M68KTranslationUnit, mt_LRUNode));
         if (debug)
-            kprintf("[ICache]   Unit %p, mt_UseCount=%lld, mt_FetchCount=%lld, M68K address %08x (range %08x-%08x)\n[ICache]      M68K insn count=%d, ARM insn count=%d\n", 
+            kprintf("[ICache]   Unit %p, mt_UseCount=%lld, mt_FetchCount=%lld, M68K address %08x (range %08x-%08x)\n[ICache]      M68K insn count=%d, ARM insn count=%d, removed by optimizer=%d\n", 
                 (void*)unit, unit->mt_UseCount, unit->mt_FetchCount,
                 (void*)unit->mt_M68kAddress, (void*)unit->mt_M68kLow, (void*)unit->mt_M68kHigh, 
-                unit->mt_M68kInsnCnt, unit->mt_ARMInsnCnt);
+                unit->mt_M68kInsnCnt, unit->mt_ARMInsnCnt, unit->mt_OptimizedCnt);
 
-        size = size + (uintptr_t)(&unit->mt_ARMCode[unit->mt_ARMInsnCnt]) - (uintptr_t)unit;
+        size = size + unit->mt_Size;
         m68k_count += unit->mt_M68kInsnCnt;
         total_arm_count += unit->mt_ARMInsnCnt;
+        optimized_cnt += unit->mt_OptimizedCnt;
         arm_count += unit->mt_ARMInsnCnt - (unit->mt_PrologueSize + unit->mt_EpilogueSize);
+        exit_cnt += unit->mt_ExitCount;
+        m68k_range += (uintptr_t)unit->mt_M68kHigh - (uintptr_t)unit->mt_M68kLow;
+        for (uint32_t i=0; i < unit->mt_ExitCount; i++)
+            if (unit->mt_Exits[i].el_Target)
+                chained_cnt++;
     }
     kprintf("[ICache] In total %d units (%d bytes) in cache\n", cnt, size);
+    kprintf("[ICache] Chainable exits: %d, chained: %d\n", exit_cnt, chained_cnt);
+    if (cnt)
+        kprintf("[ICache] Mean m68k range of a unit: %d bytes, %s fingerprints\n", (int)(m68k_range / cnt), Fingerprint_Name());
+    kprintf("[ICache] Translations: %d, promoted: %d, evicted: %d, nursery collections: %d\n",
+        cache_translations, cache_promotions, cache_evictions, cache_collections);
+    kprintf("[ICache] Units retranslated at tier 2: %d\n", cache_tierups);
+    kprintf("[ICache] Units translated by workers: %d\n", cache_speculations);
+    kprintf("[ICache] Units removed on write to their code: %d\n", cache_smc);
+    kprintf("[ICache] Units revived after full flush: %d, dropped as stale: %d\n", cache_revivals, cache_stale);
+    Policy_DumpStats();
 
     uint32_t mean = 100 * (arm_count);
     mean = mean / m68k_count;
@@ -751,6 +2887,12 @@ void M68K_DumpStats()
     mean_n = mean / 100;
     mean_f = mean % 100;
     kprintf("[ICache] Mean total ARM instructions per m68k instruction: %d.%02d\n", mean_n, mean_f);
+
+    mean = 100 * (optimized_cnt);
+    mean = mean / m68k_count;
+    mean_n = mean / 100;
+    mean_f = mean % 100;
+    kprintf("[ICache] ARM instructions removed by optimizer: %d, %d.%02d per m68k instruction\n", optimized_cnt, mean_n, mean_f);
 }
 
 uint32_t *EMIT_InjectPrintContext(uint32_t *ptr)
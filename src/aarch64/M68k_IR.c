@@ -0,0 +1,967 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include "support.h"
+#include "tlsf.h"
+#include "config.h"
+#include "M68k.h"
+#include "M68k_IR.h"
+
+/*
+    The decoders keep emitting host code directly. After every m68k instruction the translator
+    lifts the code it got into the current block of micro-ops. Once an instruction cannot be
+    lifted, or the translator emits code of its own, the block is run through the passes and
+    lowered back in place. Only the first instruction of a block may be entered from anywhere
+    else but the instruction before it, so passes may work across m68k instructions freely.
+*/
+static struct IROp *Ops;
+static uint32_t OpCount;
+static uint32_t *BlockStart;
+static uint16_t BlockFirst;
+static uint16_t BlockLast;
+
+#define IR_ALL          0xffffffffffffffffULL
+#define IR_SP_MASK      (1ULL << 31)
+
+/* Encoding of NZCV in MRS/MSR instructions */
+#define SYSREG_NZCV     0x5a10
+
+static void IR_Operand(struct IROp *op, uint8_t pos, uint8_t flags)
+{
+    uint8_t reg = (op->op_Insn >> pos) & 31;
+    uint64_t mask;
+
+    if (flags & IR_V)
+        mask = 1ULL << (32 + reg);
+    else if (reg == 31)
+        mask = (flags & IR_SP) ? IR_SP_MASK : 0;
+    else
+        mask = 1ULL << reg;
+
+    if (flags & IR_USE)
+        op->op_Use |= mask;
+    if (flags & IR_DEF)
+        op->op_Def |= mask;
+
+    op->op_Operands[op->op_OperandCount].io_Pos = pos;
+    op->op_Operands[op->op_OperandCount].io_Flags = flags;
+    op->op_OperandCount++;
+}
+
+static void IR_Opaque(struct IROp *op)
+{
+    op->op_Kind = IR_OPAQUE;
+    op->op_Flags |= IRF_SETS_NZCV | IRF_USES_NZCV;
+    op->op_Def = IR_ALL;
+    op->op_Use = IR_ALL;
+    op->op_OperandCount = 0;
+}
+
+/* Loads and stores. Literal loads are PC-relative and cannot be lifted */
+static int IR_DecodeMemory(struct IROp *op)
+{
+    uint32_t insn = op->op_Insn;
+    uint8_t v = (insn & (1 << 26)) ? IR_V : 0;
+
+    if ((insn & 0x3b000000) == 0x18000000)
+        return 0;
+
+    /* Load/store pair */
+    if ((insn & 0x38000000) == 0x28000000)
+    {
+        uint8_t idx = (insn >> 23) & 3;
+        uint8_t opc = insn >> 30;
+        uint8_t load = (insn >> 22) & 1;
+        uint8_t width = (v || opc != 0) ? IR_W64 : 0;
+
+        op->op_Kind = load ? IR_LOAD : IR_STORE;
+        IR_Operand(op, 0, (load ? IR_DEF : IR_USE) | v | width);
+        IR_Operand(op, 10, (load ? IR_DEF : IR_USE) | v | width);
+        if (idx == 1 || idx == 3)
+        {
+            IR_Operand(op, 5, IR_USE | IR_DEF | IR_SP | IR_W64);
+            op->op_Flags |= IRF_WRITEBACK;
+        }
+        else
+            IR_Operand(op, 5, IR_USE | IR_SP | IR_W64);
+
+        return 1;
+    }
+
+    /* Load/store register, all addressing modes but literal */
+    if ((insn & 0x38000000) == 0x38000000)
+    {
+        uint8_t size = insn >> 30;
+        uint8_t opc = (insn >> 22) & 3;
+        uint8_t rt_flags;
+
+        if (v)
+            rt_flags = ((opc & 1) ? IR_DEF : IR_USE) | IR_V | IR_W64;
+        else if (opc == 0)
+            rt_flags = IR_USE | (size == 3 ? IR_W64 : 0);
+        else if (size == 3 && opc == 2)
+            rt_flags = 0;   /* PRFM */
+        else if (size == 3 && opc == 3)
+        {
+            IR_Opaque(op);
+            return 1;
+        }
+        else
+            rt_flags = IR_DEF;
+
+        op->op_Kind = (rt_flags & IR_DEF) || rt_flags == 0 ? IR_LOAD : IR_STORE;
+
+        if (insn & (1 << 24))
+        {
+            IR_Operand(op, 5, IR_USE | IR_SP | IR_W64);
+        }
+        else if ((insn & (1 << 21)) == 0)
+        {
+            uint8_t idx = (insn >> 10) & 3;
+
+            if (idx == 1 || idx == 3)
+            {
+                IR_Operand(op, 5, IR_USE | IR_DEF | IR_SP | IR_W64);
+                op->op_Flags |= IRF_WRITEBACK;
+            }
+            else
+                IR_Operand(op, 5, IR_USE | IR_SP | IR_W64);
+        }
+        else if (((insn >> 10) & 3) == 2)
+        {
+            uint8_t option = (insn >> 13) & 7;
+
+            IR_Operand(op, 5, IR_USE | IR_SP | IR_W64);
+            IR_Operand(op, 16, IR_USE | ((option & 3) == 3 ? IR_W64 : 0));
+        }
+        else
+        {
+            /* Atomic memory operations */
+            IR_Opaque(op);
+            return 1;
+        }
+
+        if (rt_flags)
+            IR_Operand(op, 0, rt_flags);
+
+        return 1;
+    }
+
+    /* Exclusives, SIMD structure loads and anything else */
+    IR_Opaque(op);
+
+    return 1;
+}
+
+static int IR_DecodeRegister(struct IROp *op)
+{
+    uint32_t insn = op->op_Insn;
+    uint8_t sf = (insn & (1U << 31)) ? IR_W64 : 0;
+    uint8_t s = (insn >> 29) & 1;
+
+    op->op_Kind = IR_ALU;
+
+    if ((insn & (1 << 28)) == 0)
+    {
+        /* Logical (shifted register) */
+        if ((insn & (1 << 24)) == 0)
+        {
+            IR_Operand(op, 0, IR_DEF | sf);
+            IR_Operand(op, 5, IR_USE | sf);
+            IR_Operand(op, 16, IR_USE | sf);
+            if (((insn >> 29) & 3) == 3)
+                op->op_Flags |= IRF_SETS_NZCV;
+        }
+        /* Add/subtract (shifted register) */
+        else if ((insn & (1 << 21)) == 0)
+        {
+            IR_Operand(op, 0, IR_DEF | sf);
+            IR_Operand(op, 5, IR_USE | sf);
+            IR_Operand(op, 16, IR_USE | sf);
+            if (s)
+                op->op_Flags |= IRF_SETS_NZCV;
+        }
+        /* Add/subtract (extended register) */
+        else
+        {
+            uint8_t option = (insn >> 13) & 7;
+
+            IR_Operand(op, 0, IR_DEF | sf | (s ? 0 : IR_SP));
+            IR_Operand(op, 5, IR_USE | sf | IR_SP);
+            IR_Operand(op, 16, IR_USE | ((option & 3) == 3 ? IR_W64 : 0));
+            if (s)
+                op->op_Flags |= IRF_SETS_NZCV;
+        }
+
+        return 1;
+    }
+
+    switch ((insn >> 21) & 15)
+    {
+        case 0:     /* ADC/SBC */
+            if ((insn >> 10) & 63)
+                break;
+            IR_Operand(op, 0, IR_DEF | sf);
+            IR_Operand(op, 5, IR_USE | sf);
+            IR_Operand(op, 16, IR_USE | sf);
+            op->op_Flags |= IRF_USES_NZCV | (s ? IRF_SETS_NZCV : 0);
+            return 1;
+
+        case 2:     /* CCMP/CCMN */
+            if (!s)
+                break;
+            IR_Operand(op, 5, IR_USE | sf);
+            if ((insn & (1 << 11)) == 0)
+                IR_Operand(op, 16, IR_USE | sf);
+            op->op_Flags |= IRF_USES_NZCV | IRF_SETS_NZCV;
+            return 1;
+
+        case 4:     /* CSEL/CSINC/CSINV/CSNEG */
+            IR_Operand(op, 0, IR_DEF | sf);
+            IR_Operand(op, 5, IR_USE | sf);
+            IR_Operand(op, 16, IR_USE | sf);
+            op->op_Flags |= IRF_USES_NZCV;
+            return 1;
+
+        case 6:
+            /* Data processing (1 source), only REV/CLZ/RBIT and friends */
+            if (insn & (1 << 30))
+            {
+                if ((insn >> 16) & 31)
+                    break;
+                IR_Operand(op, 0, IR_DEF | sf);
+                IR_Operand(op, 5, IR_USE | sf);
+                return 1;
+            }
+            /* Data processing (2 source) but CRC32 */
+            if (((insn >> 10) & 63) >= 16)
+                break;
+            IR_Operand(op, 0, IR_DEF | sf);
+            IR_Operand(op, 5, IR_USE | sf);
+            IR_Operand(op, 16, IR_USE | sf);
+            return 1;
+
+        case 8: case 9: case 10: case 11:
+        case 12: case 13: case 14: case 15:
+        {
+            /* Data processing (3 source) */
+            uint8_t op31 = (insn >> 21) & 7;
+
+            IR_Operand(op, 0, IR_DEF | sf);
+            if (op31 == 0)
+            {
+                IR_Operand(op, 5, IR_USE | sf);
+                IR_Operand(op, 16, IR_USE | sf);
+                IR_Operand(op, 10, IR_USE | sf);
+            }
+            else if (op31 == 1 || op31 == 5)
+            {
+                IR_Operand(op, 5, IR_USE);
+                IR_Operand(op, 16, IR_USE);
+                IR_Operand(op, 10, IR_USE | IR_W64);
+            }
+            else if (op31 == 2 || op31 == 6)
+            {
+                IR_Operand(op, 5, IR_USE | IR_W64);
+                IR_Operand(op, 16, IR_USE | IR_W64);
+            }
+            else
+                break;
+            return 1;
+        }
+
+        default:
+            break;
+    }
+
+    IR_Opaque(op);
+
+    return 1;
+}
+
+/*
+    Decode host instruction of the op. Returns zero if the instruction may not be part of
+    a block: branches, PC-relative instructions, unallocated encodings and translator markers.
+*/
+static int IR_Decode(struct IROp *op)
+{
+    uint32_t insn = op->op_Insn;
+    uint8_t sf = (insn & (1U << 31)) ? IR_W64 : 0;
+    uint8_t opc = (insn >> 29) & 3;
+
+    op->op_Kind = IR_ALU;
+    op->op_Flags &= IRF_DEAD;
+    op->op_Def = 0;
+    op->op_Use = 0;
+    op->op_OperandCount = 0;
+
+    if ((insn & 0xfffffff0) == 0xfffffff0)
+        return 0;
+
+    switch ((insn >> 25) & 15)
+    {
+        /* Data processing (immediate) */
+        case 8: case 9:
+            switch ((insn >> 23) & 7)
+            {
+                case 0: case 1:     /* ADR/ADRP */
+                    return 0;
+
+                case 2:             /* ADD/SUB (immediate) */
+                    IR_Operand(op, 0, IR_DEF | sf | ((opc & 1) ? 0 : IR_SP));
+                    IR_Operand(op, 5, IR_USE | sf | IR_SP);
+                    if (opc & 1)
+                        op->op_Flags |= IRF_SETS_NZCV;
+                    return 1;
+
+                case 4:             /* Logical (immediate) */
+                    IR_Operand(op, 0, IR_DEF | sf | (opc == 3 ? 0 : IR_SP));
+                    IR_Operand(op, 5, IR_USE | sf);
+                    if (opc == 3)
+                        op->op_Flags |= IRF_SETS_NZCV;
+                    return 1;
+
+                case 5:             /* MOVN/MOVZ/MOVK */
+                    if (opc == 1)
+                        break;
+                    IR_Operand(op, 0, (opc == 3 ? IR_USE | IR_DEF : IR_DEF) | sf);
+                    return 1;
+
+                case 6:             /* SBFM/BFM/UBFM */
+                    if (opc == 3)
+                        break;
+                    IR_Operand(op, 0, (opc == 1 ? IR_USE | IR_DEF : IR_DEF) | sf);
+                    IR_Operand(op, 5, IR_USE | sf);
+                    return 1;
+
+                case 7:             /* EXTR */
+                    IR_Operand(op, 0, IR_DEF | sf);
+                    IR_Operand(op, 5, IR_USE | sf);
+                    IR_Operand(op, 16, IR_USE | sf);
+                    return 1;
+
+                default:
+                    break;
+            }
+            IR_Opaque(op);
+            return 1;
+
+        /* Branches, exceptions and system instructions */
+        case 10: case 11:
+            if ((insn & 0xfff00000) == 0xd5300000)
+            {
+                /* MRS has no side effects on the registers used by the translator */
+                IR_Operand(op, 0, IR_DEF | IR_W64);
+                if (((insn >> 5) & 0x7fff) == SYSREG_NZCV)
+                    op->op_Flags |= IRF_USES_NZCV;
+                return 1;
+            }
+            if ((insn & 0xfff00000) == 0xd5100000)
+            {
+                op->op_Kind = IR_SYS;
+                IR_Operand(op, 0, IR_USE | IR_W64);
+                if (((insn >> 5) & 0x7fff) == SYSREG_NZCV)
+                    op->op_Flags |= IRF_SETS_NZCV;
+                return 1;
+            }
+            if ((insn & 0xffc00000) == 0xd5000000)
+            {
+                IR_Opaque(op);
+                op->op_Kind = IR_SYS;
+                return 1;
+            }
+            return 0;
+
+        /* Loads and stores */
+        case 4: case 6: case 12: case 14:
+            return IR_DecodeMemory(op);
+
+        /* Data processing (register) */
+        case 5: case 13:
+            return IR_DecodeRegister(op);
+
+        /* SIMD and floating point */
+        case 7: case 15:
+            IR_Opaque(op);
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+void IR_Init()
+{
+    Ops = tlsf_malloc(tlsf, sizeof(struct IROp) * IR_MAX_OPS);
+    OpCount = 0;
+    BlockStart = NULL;
+}
+
+int IR_IsEmpty()
+{
+    return BlockStart == NULL;
+}
+
+/*
+    Append code emitted for m68k instruction with given index to the block. Returns zero if
+    the code cannot be lifted, the block is left unchanged then.
+*/
+int IR_Lift(uint32_t *start, uint32_t *end, uint16_t index)
+{
+    uint32_t count = end - start;
+
+    if (OpCount + count > IR_MAX_OPS)
+        return 0;
+
+    for (uint32_t i=0; i < count; i++)
+    {
+        struct IROp *op = &Ops[OpCount + i];
+
+        op->op_Insn = INSN_TO_LE(start[i]);
+        op->op_Index = index;
+        op->op_Flags = 0;
+
+        if (!IR_Decode(op))
+            return 0;
+    }
+
+    if (BlockStart == NULL)
+    {
+        BlockStart = start;
+        BlockFirst = index;
+    }
+    BlockLast = index;
+    OpCount += count;
+
+    return 1;
+}
+
+/*
+    Registers written by the host code between start and end, in the same form as op_Def.
+    Unlike lifting this accepts branches, they write nothing but the link register and, for
+    calls, registers not preserved by the callee. Code which cannot be decoded writes everything.
+*/
+uint64_t IR_GetDefs(uint32_t *start, uint32_t *end)
+{
+    struct IROp op;
+    uint64_t defs = 0;
+
+    for (; start < end; start++)
+    {
+        op.op_Insn = INSN_TO_LE(*start);
+        op.op_Flags = 0;
+
+        if (IR_Decode(&op))
+            defs |= op.op_Def;
+        else if ((op.op_Insn & 0x7c000000) == 0x14000000 || (op.op_Insn & 0xfe000000) == 0xd6000000)
+        {
+            /* B, BL, BR, BLR, RET */
+            if ((op.op_Insn & 0xfc000000) == 0x94000000 || (op.op_Insn & 0xffe00000) == 0xd6200000)
+                defs |= 0x4007ffffULL;
+        }
+        else if ((op.op_Insn & 0xfe000000) == 0x54000000 || (op.op_Insn & 0x7c000000) == 0x34000000)
+        {
+            /* B.cond, CBZ, CBNZ, TBZ, TBNZ */
+        }
+        else if ((op.op_Insn & 0x1f000000) == 0x10000000 || (op.op_Insn & 0x3b000000) == 0x18000000)
+            defs |= 1ULL << (op.op_Insn & 31);    /* ADR, ADRP, literal loads */
+        else
+            return IR_ALL;
+    }
+
+    return defs;
+}
+
+/* MOV (register), alias of ORR with zero register and no shift */
+static inline int IR_IsMove(uint32_t insn)
+{
+    return (insn & 0x7fe0ffe0) == 0x2a0003e0;
+}
+
+/*
+    Forward copy propagation. Reads of a register copied with MOV are redirected to the source
+    of the copy as long as neither of them was written since. A copy made with 32-bit MOV
+    replaces only 32-bit reads. The MOV itself is left for dead code elimination.
+*/
+static void IR_PropagateCopies()
+{
+    uint8_t copy_of[31];
+    uint8_t copy_w64[31];
+
+    for (int r=0; r < 31; r++)
+        copy_of[r] = 0xff;
+
+    for (uint32_t i=0; i < OpCount; i++)
+    {
+        struct IROp *op = &Ops[i];
+        int changed = 0;
+
+        if (op->op_Kind != IR_OPAQUE && !(op->op_Flags & IRF_WRITEBACK))
+        {
+            for (int o=0; o < op->op_OperandCount; o++)
+            {
+                struct IROperand *opnd = &op->op_Operands[o];
+                uint8_t reg = (op->op_Insn >> opnd->io_Pos) & 31;
+
+                if ((opnd->io_Flags & (IR_USE | IR_DEF | IR_V)) != IR_USE || reg == 31 || copy_of[reg] == 0xff)
+                    continue;
+                if ((opnd->io_Flags & IR_W64) && !copy_w64[reg])
+                    continue;
+
+                op->op_Insn = (op->op_Insn & ~(31 << opnd->io_Pos)) | (copy_of[reg] << opnd->io_Pos);
+                changed = 1;
+            }
+
+            if (changed)
+                IR_Decode(op);
+        }
+
+        /* Forget copies to or from registers written here */
+        for (int r=0; r < 31; r++)
+        {
+            if (copy_of[r] != 0xff && ((op->op_Def & (1ULL << r)) || (op->op_Def & (1ULL << copy_of[r]))))
+                copy_of[r] = 0xff;
+        }
+
+        if (IR_IsMove(op->op_Insn))
+        {
+            uint8_t rd = op->op_Insn & 31;
+            uint8_t rm = (op->op_Insn >> 16) & 31;
+
+            if (rd != 31 && rm != 31 && rd != rm)
+            {
+                copy_of[rd] = rm;
+                copy_w64[rd] = (op->op_Insn >> 31) & 1;
+            }
+        }
+    }
+}
+
+/*
+    Remove ops without side effects whose results are never read. At the end of the block all
+    registers are live but the temporaries not allocated at that point. Loads and stores may
+    fault and the fault handler takes m68k state from registers, so at every memory access
+    all registers but the temporaries are live, together with the temporaries which hold
+    modified CC, FPCR or FPSR at the start of the instruction.
+*/
+static void IR_EliminateDeadCode(uint16_t live_temps, struct M68KLocalState *local_state)
+{
+    uint64_t live = IR_ALL & ~(uint64_t)(0xfff & ~live_temps);
+    int nzcv_live = 1;
+
+    for (int i=OpCount - 1; i >= 0; --i)
+    {
+        struct IROp *op = &Ops[i];
+
+        if (op->op_Flags & IRF_DEAD)
+            continue;
+
+        if (op->op_Kind == IR_ALU && (op->op_Def || (op->op_Flags & IRF_SETS_NZCV)) &&
+            !(op->op_Def & live) && !((op->op_Flags & IRF_SETS_NZCV) && nzcv_live))
+        {
+            op->op_Flags |= IRF_DEAD;
+            continue;
+        }
+
+        live &= ~op->op_Def;
+        live |= op->op_Use;
+        if (op->op_Kind == IR_LOAD || op->op_Kind == IR_STORE)
+        {
+            live |= IR_ALL & ~0xfffULL;
+            for (int r=0; r < 3; r++)
+            {
+                if (local_state[op->op_Index].mls_Modified[r] < 12)
+                    live |= 1ULL << local_state[op->op_Index].mls_Modified[r];
+            }
+        }
+        if (op->op_Flags & IRF_SETS_NZCV)
+            nzcv_live = 0;
+        if (op->op_Flags & IRF_USES_NZCV)
+            nzcv_live = 1;
+    }
+}
+
+/* Non-zero if a live load or store lies between ops i and j */
+static int IR_MemoryBetween(uint32_t i, uint32_t j)
+{
+    while (++i < j && i < OpCount)
+    {
+        if (!(Ops[i].op_Flags & IRF_DEAD) && (Ops[i].op_Kind == IR_LOAD || Ops[i].op_Kind == IR_STORE))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Host register of m68k A0-A7, updates of these are undone by the access fault handler */
+static inline int IR_IsAddressReg(uint8_t reg)
+{
+    return (reg >= REG_A0 && reg < REG_A0 + 5) || (reg >= REG_A5 && reg <= REG_A7);
+}
+
+/* Next live op after i which reads or writes any of regs, OpCount if there is none */
+static uint32_t IR_NextAccess(uint32_t i, uint64_t regs)
+{
+    while (++i < OpCount)
+    {
+        if (!(Ops[i].op_Flags & IRF_DEAD) && ((Ops[i].op_Use | Ops[i].op_Def) & regs))
+            break;
+    }
+
+    return i;
+}
+
+/* ADD/SUB (immediate) without flags and shift, returns the immediate as signed value */
+static inline int IR_IsAddImm(uint32_t insn, int32_t *imm)
+{
+    if ((insn & 0x3fc00000) != 0x11000000)
+        return 0;
+
+    *imm = (insn >> 10) & 0xfff;
+    if (insn & (1 << 30))
+        *imm = -*imm;
+
+    return 1;
+}
+
+static inline uint32_t IR_SetAddImm(uint32_t insn, int32_t imm)
+{
+    insn &= ~((1 << 30) | (0xfff << 10));
+    if (imm < 0)
+    {
+        insn |= 1 << 30;
+        imm = -imm;
+    }
+
+    return insn | (imm << 10);
+}
+
+/* Value of the 32-bit logical immediate in AND/ORR/EOR (immediate) */
+static int IR_DecodeLogical32(uint32_t insn, uint32_t *value)
+{
+    uint8_t immr = (insn >> 16) & 63;
+    uint8_t imms = (insn >> 10) & 63;
+    uint32_t elem;
+    int esize;
+
+    if (insn & (1 << 22))
+        return 0;
+
+    for (esize = 32; esize > 1; esize >>= 1)
+    {
+        if (!(imms & esize))
+            break;
+    }
+
+    if (esize == 1 || (imms & (esize - 1)) == esize - 1)
+        return 0;
+
+    imms &= esize - 1;
+    immr &= esize - 1;
+    elem = (imms == 31) ? 0xffffffff : (1U << (imms + 1)) - 1;
+    if (immr)
+        elem = (elem >> immr) | (elem << (esize - immr));
+    if (esize < 32)
+        elem &= (1U << esize) - 1;
+
+    *value = 0;
+    for (int i=0; i < 32; i += esize)
+        *value |= elem << i;
+
+    return 1;
+}
+
+/* Encode value as 32-bit logical immediate, only masks with one run of ones are considered */
+static int IR_EncodeLogical32(uint32_t value, uint32_t *insn)
+{
+    if (value == 0 || value == 0xffffffff)
+        return 0;
+
+    for (int r=0; r < 32; r++)
+    {
+        uint32_t v = r ? (value << r) | (value >> (32 - r)) : value;
+
+        if ((v & (v + 1)) == 0)
+        {
+            *insn = (*insn & ~(0x1fff << 10)) | (r << 16) | ((__builtin_popcount(v) - 1) << 10);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* 32-bit AND or ORR (immediate) with Rd == Rn, a partial write of the register */
+static inline int IR_IsMaskImm(uint32_t insn)
+{
+    return (insn & 0xdf800000) == 0x12000000 && (insn & 31) != 31 && ((insn >> 5) & 31) == (insn & 31);
+}
+
+/*
+    Local rewrites of single ops and pairs of ops on the same register: moves of a register to
+    itself and additions of zero are dropped, adjacent additions of immediates to a register
+    (adjustments of m68k PC are the usual case) are merged, as are adjacent masks applied to a
+    register by AND or ORR (immediate), as used on the condition codes. Pairs separated by a
+    load or store are left alone, a fault in between has to see the register as it was.
+*/
+static void IR_CombineImmediates()
+{
+    for (uint32_t i=0; i < OpCount; i++)
+    {
+        struct IROp *op = &Ops[i];
+        uint32_t insn = op->op_Insn;
+        uint8_t rd = insn & 31;
+        int32_t imm;
+
+        if (op->op_Flags & IRF_DEAD)
+            continue;
+
+        /* mov xN, xN */
+        if ((insn & 0xffe0ffe0) == 0xaa0003e0 && rd != 31 && rd == ((insn >> 16) & 31))
+        {
+            op->op_Flags |= IRF_DEAD;
+            continue;
+        }
+
+        if (IR_IsAddImm(insn, &imm) && rd != 31 && rd == ((insn >> 5) & 31))
+        {
+            uint32_t j;
+            int32_t imm2;
+
+            /* add xN, xN, #0. The 32-bit form clears upper half of the register and has to stay */
+            if (imm == 0 && (insn >> 31))
+            {
+                op->op_Flags |= IRF_DEAD;
+                continue;
+            }
+
+            /* Additions to An are merged within one m68k instruction only, see M68K_GetWriteback */
+            j = IR_NextAccess(i, 1ULL << rd);
+            if (j < OpCount && !IR_MemoryBetween(i, j) && (!IR_IsAddressReg(rd) || Ops[j].op_Index == op->op_Index) && (Ops[j].op_Insn >> 31) == (insn >> 31) && (Ops[j].op_Insn & 31) == rd &&
+                ((Ops[j].op_Insn >> 5) & 31) == rd && IR_IsAddImm(Ops[j].op_Insn, &imm2))
+            {
+                imm2 += imm;
+                if (imm2 > -4096 && imm2 < 4096 && (imm2 != 0 || (insn >> 31) == 0))
+                {
+                    Ops[j].op_Insn = IR_SetAddImm(Ops[j].op_Insn, imm2);
+                    op->op_Flags |= IRF_DEAD;
+                }
+                else if (imm2 == 0)
+                {
+                    Ops[j].op_Flags |= IRF_DEAD;
+                    op->op_Flags |= IRF_DEAD;
+                }
+            }
+            continue;
+        }
+
+        if (IR_IsMaskImm(insn))
+        {
+            uint32_t j = IR_NextAccess(i, 1ULL << rd);
+            uint32_t mask, mask2;
+
+            if (j < OpCount && !IR_MemoryBetween(i, j) && IR_IsMaskImm(Ops[j].op_Insn) && (Ops[j].op_Insn & 31) == rd &&
+                (Ops[j].op_Insn & 0x60000000) == (insn & 0x60000000) &&
+                IR_DecodeLogical32(insn, &mask) && IR_DecodeLogical32(Ops[j].op_Insn, &mask2))
+            {
+                uint32_t merged = Ops[j].op_Insn;
+
+                if (insn & 0x20000000)
+                    mask |= mask2;
+                else
+                    mask &= mask2;
+
+                if (IR_EncodeLogical32(mask, &merged))
+                {
+                    Ops[j].op_Insn = merged;
+                    op->op_Flags |= IRF_DEAD;
+                }
+            }
+        }
+    }
+}
+
+/*
+    Fold address arithmetic "add xT, xB, #imm" into the immediate offset of loads and stores
+    which use xT as base. Only 64-bit additions are folded, so the fold does not change how
+    addresses wrap. The add itself stays for dead code elimination to decide.
+*/
+static void IR_FoldAddressing()
+{
+    for (uint32_t i=0; i < OpCount; i++)
+    {
+        uint32_t insn = Ops[i].op_Insn;
+        uint8_t rt = insn & 31;
+        uint8_t rb = (insn >> 5) & 31;
+        uint32_t j = i;
+        int32_t imm;
+
+        /* Only 64-bit sums, a 32-bit one wraps at 4GB and the address in LDR/STR does not */
+        if ((Ops[i].op_Flags & IRF_DEAD) || !IR_IsAddImm(insn, &imm) || !(insn >> 31) || rt == 31 || rb == 31 || rt == rb)
+            continue;
+
+        while ((j = IR_NextAccess(j, (1ULL << rt) | (1ULL << rb))) < OpCount)
+        {
+            struct IROp *op = &Ops[j];
+            uint32_t mem = op->op_Insn;
+            uint8_t scale = mem >> 30;
+            int32_t offset;
+
+            /* Stop at anything redefining base or using the sum other than as base of LDR/STR */
+            if ((op->op_Def & (1ULL << rb)) || (op->op_Def & (1ULL << rt)))
+                break;
+            if (!(op->op_Use & (1ULL << rt)))
+                continue;
+            if (op->op_Kind != IR_LOAD && op->op_Kind != IR_STORE)
+                break;
+            if ((mem & 0x3f000000) != 0x39000000 && (mem & 0x3f200c00) != 0x38000000)
+                break;
+            if (((mem >> 5) & 31) != rt || (op->op_Flags & IRF_WRITEBACK))
+                break;
+
+            if (mem & (1 << 24))
+                offset = ((mem >> 10) & 0xfff) << scale;
+            else
+                offset = ((int32_t)(mem << 11)) >> 23;
+            offset += imm;
+
+            mem &= ~((31 << 5) | (1 << 24) | (0xfff << 10));
+            if (offset >= 0 && offset < (4096 << scale) && (offset & ((1 << scale) - 1)) == 0)
+                mem |= (1 << 24) | ((offset >> scale) << 10);
+            else if (offset >= -256 && offset < 256)
+                mem |= (offset & 0x1ff) << 12;
+            else
+                break;
+
+            op->op_Insn = mem | (rb << 5);
+            IR_Decode(op);
+
+            /* A store of the sum itself still needs it */
+            if (op->op_Use & (1ULL << rt))
+                break;
+        }
+    }
+}
+
+/*
+    Remove partial writes of a register which are completely overwritten before anything reads
+    them. Condition codes are updated with chains of BFI, BFXIL, AND and ORR on one register,
+    where later writes often replace earlier ones. Liveness is tracked per bit. Nothing is
+    removed across a load or store, which may fault and expose the register.
+*/
+static void IR_EliminateDeadInserts()
+{
+    uint64_t dead[31];
+
+    for (int r=0; r < 31; r++)
+        dead[r] = 0;
+
+    for (int i=OpCount - 1; i >= 0; --i)
+    {
+        struct IROp *op = &Ops[i];
+        uint32_t insn = op->op_Insn;
+        uint8_t rd = insn & 31;
+        uint64_t written = 0;
+
+        if (op->op_Flags & IRF_DEAD)
+            continue;
+
+        if (op->op_Kind == IR_LOAD || op->op_Kind == IR_STORE)
+        {
+            for (int r=0; r < 31; r++)
+                dead[r] = 0;
+            continue;
+        }
+
+        /* 32-bit BFM, each write clears upper half of the register */
+        if ((insn & 0xffc00000) == 0x33000000 && rd != 31 && ((insn >> 5) & 31) != rd)
+        {
+            uint8_t immr = (insn >> 16) & 63;
+            uint8_t imms = (insn >> 10) & 63;
+
+            if (immr < 32 && imms < 32)
+            {
+                if (imms >= immr)
+                    written = (2ULL << (imms - immr)) - 1;
+                else
+                    written = ((2ULL << imms) - 1) << (32 - immr);
+                written = (written & 0xffffffff) | 0xffffffff00000000ULL;
+            }
+        }
+        else if (IR_IsMaskImm(insn))
+        {
+            uint32_t mask;
+
+            if (IR_DecodeLogical32(insn, &mask))
+                written = ((insn & 0x20000000) ? mask : ~mask) | 0xffffffff00000000ULL;
+        }
+
+        if (written)
+        {
+            if ((written & ~dead[rd]) == 0)
+            {
+                op->op_Flags |= IRF_DEAD;
+                continue;
+            }
+
+            dead[rd] |= written;
+            for (int r=0; r < 31; r++)
+            {
+                if (r != rd && (op->op_Use & (1ULL << r)))
+                    dead[r] = 0;
+            }
+            continue;
+        }
+
+        for (int r=0; r < 31; r++)
+        {
+            if (op->op_Def & (1ULL << r))
+                dead[r] = IR_ALL;
+            if (op->op_Use & (1ULL << r))
+                dead[r] = 0;
+        }
+    }
+}
+
+/*
+    Run the passes over current block and write it back in place. Offsets of m68k instructions
+    in the block are updated in local state. Returns the new end of the code, the block is empty
+    afterwards. Temporaries in live_temps are in use at the end of the block, which ends at end.
+*/
+uint32_t *IR_Lower(uint32_t *arm_code, uint32_t *end, struct M68KLocalState *local_state, uint16_t live_temps)
+{
+    uint32_t *out = BlockStart;
+    uint32_t next = BlockFirst;
+
+    if (BlockStart == NULL)
+        return end;
+
+    IR_PropagateCopies();
+    IR_FoldAddressing();
+    IR_CombineImmediates();
+    IR_EliminateDeadInserts();
+    IR_EliminateDeadCode(live_temps, local_state);
+
+    for (uint32_t i=0; i < OpCount; i++)
+    {
+        while (next <= Ops[i].op_Index)
+            local_state[next++].mls_ARMOffset = out - arm_code;
+
+        if (!(Ops[i].op_Flags & IRF_DEAD))
+            *out++ = INSN_TO_LE(Ops[i].op_Insn);
+    }
+
+    while (next <= BlockLast)
+        local_state[next++].mls_ARMOffset = out - arm_code;
+
+    OpCount = 0;
+    BlockStart = NULL;
+
+    return out;
+}
@@ -440,6 +440,74 @@ uint8_t RA_MapM68kRegisterForWrite(uint32_t **arm_stream, uint8_t m68k_reg)
     return _reg_map_m68k_to_arm[m68k_reg & 15];
 }
 
+/*
+    Values of m68k registers known at translation time. A register is known from the instruction
+    loading it with a constant until the host code of any later instruction writes it. Every
+    value remembers the instruction which set it, so that the translator can tell which
+    instructions depend on values set before them.
+*/
+static uint32_t known_value[16];
+static uint32_t known_insn[16];
+static uint16_t known_mask = 0;
+static uint16_t known_set = 0;
+static int32_t known_used = -1;
+
+void RA_ResetKnownValues()
+{
+    known_mask = 0;
+    known_set = 0;
+    known_used = -1;
+}
+
+void RA_SetKnownValue(uint8_t m68k_reg, uint32_t value)
+{
+    known_value[m68k_reg & 15] = value;
+    known_mask |= 1 << (m68k_reg & 15);
+    known_set |= 1 << (m68k_reg & 15);
+}
+
+int RA_GetKnownValue(uint8_t m68k_reg, uint32_t *value)
+{
+    if (!(known_mask & (1 << (m68k_reg & 15))))
+        return 0;
+
+    *value = known_value[m68k_reg & 15];
+
+    return 1;
+}
+
+/* Code of current instruction relies on the known value of m68k_reg */
+void RA_UseKnownValue(uint8_t m68k_reg)
+{
+    uint8_t r = m68k_reg & 15;
+
+    if (!(known_set & (1 << r)) && (known_used < 0 || known_insn[r] < (uint32_t)known_used))
+        known_used = known_insn[r];
+}
+
+/*
+    Called after every m68k instruction with the mask of host registers its code writes. Values
+    of written registers are forgotten unless the instruction itself set them. Returns index of
+    the earliest instruction whose known value was used, or -1.
+*/
+int RA_UpdateKnownValues(uint64_t host_defs, uint32_t insn)
+{
+    int used = known_used;
+
+    for (int r=0; r < 16; r++)
+    {
+        if (known_set & (1 << r))
+            known_insn[r] = insn;
+        else if (host_defs & (1ULL << _reg_map_m68k_to_arm[r]))
+            known_mask &= ~(1 << r);
+    }
+
+    known_set = 0;
+    known_used = -1;
+
+    return used;
+}
+
 
 static uint8_t reg_CC = 0xff;
 static uint8_t mod_CC = 0;
@@ -606,11 +674,25 @@ void RA_FlushCC(uint32_t **ptr)
     mod_CC = 0;
 }
 
+/* Non-zero if none of CC, CTX, FPCR or FPSR is held in an ARM register */
+int RA_IsStateFlushed()
+{
+    return reg_CC == 0xff && reg_CTX == 0xff && reg_FPCR == 0xff && reg_FPSR == 0xff;
+}
+
 int RA_IsCCLoaded()
 {
     return (reg_CC != 0xff);
 }
 
+/* Registers holding CC, FPCR and FPSR not written back yet, 0xff for state which is up to date */
+void RA_GetModifiedState(uint8_t *regs)
+{
+    regs[0] = mod_CC ? reg_CC : 0xff;
+    regs[1] = mod_FPCR ? reg_FPCR : 0xff;
+    regs[2] = mod_FPSR ? reg_FPSR : 0xff;
+}
+
 int RA_IsCCModified()
 {
     return (mod_CC != 0);
@@ -392,6 +392,127 @@ void mmu_map(uintptr_t phys, uintptr_t virt, uintptr_t length, uint32_t attr_low
     }
 }
 
+/* Number of block splits in progress, other cores may take translation faults meanwhile */
+static volatile uint32_t mmu_splitting;
+
+/*
+    Replace a live 1GB or 2MB block of the lower address space with a table of 512 smaller
+    mappings with the same attributes. Other cores may use the block meanwhile, so the old entry
+    is removed and invalidated in all TLBs before the table is installed (break-before-make).
+    Their accesses fault in between, the exception handler retries them with mmu_fault_retry.
+*/
+static void split_block(uint64_t *tbl, int level, uintptr_t virt)
+{
+    int idx = (virt >> (level == 1 ? 30 : 21)) & 0x1ff;
+    uint64_t entry = tbl[idx];
+    uint64_t attr = entry & 0xfff0000000000ffcULL;
+    uint64_t base = entry & (level == 1 ? 0x0000ffffc0000000ULL : 0x0000ffffffe00000ULL);
+    uint64_t step = level == 1 ? 0x200000 : 0x1000;
+    struct mmu_page *p = get_4k_page();
+
+    DMAP(kprintf("splitting level %d block %016x\n", level, entry));
+
+    /* 1GB block becomes 2MB blocks, 2MB block becomes 4K pages */
+    for (int i=0; i < 512; i++)
+        p->mp_entries[i] = (base + i * step) | attr | (level == 1 ? MMU_PAGE : 3);
+
+    __atomic_add_fetch(&mmu_splitting, 1, __ATOMIC_SEQ_CST);
+    tbl[idx] = 0;
+
+    asm volatile(
+"       dsb     ishst           \n"
+"       tlbi    vaae1is, %0     \n"
+"       dsb     ish             \n"
+    ::"r"(virt >> 12):"memory");
+
+    tbl[idx] = 3 | ((uintptr_t)p & 0xffffffff);
+
+    asm volatile(
+"       dsb     ishst           \n"
+"       isb                     \n"
+    :::"memory");
+    __atomic_sub_fetch(&mmu_splitting, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+    Called on a translation fault at virt. Waits until no block split is in progress and returns
+    1 if the address is mapped now. The fault was caused by a split then and the access can be
+    restarted.
+*/
+int mmu_fault_retry(uintptr_t virt)
+{
+    uint64_t par;
+
+    while (__atomic_load_n(&mmu_splitting, __ATOMIC_SEQ_CST))
+        asm volatile("yield");
+
+    asm volatile("at s1e1r, %1; isb; mrs %0, PAR_EL1":"=r"(par):"r"(virt));
+
+    return (par & 1) == 0;
+}
+
+/*
+    Change write access of a single 4K page in the lower address space. Block mappings are split
+    on the way. Returns 1 if the page changed its state, 0 if it was in requested state already
+    and -1 if the page is not mapped at all.
+*/
+int mmu_protect(uintptr_t virt, int read_only)
+{
+    uint64_t *tbl;
+    uint64_t entry;
+    int level;
+
+    virt &= ~0xfffUL;
+
+    DMAP(kprintf("mmu_protect(%p, %d)\n", virt, read_only));
+
+    while (1)
+    {
+        asm volatile("mrs %0, TTBR0_EL1":"=r"(tbl));
+        tbl = (uint64_t *)((uintptr_t)tbl | 0xffffffff00000000);
+
+        level = 1;
+        entry = tbl[(virt >> 30) & 0x1ff];
+
+        if ((entry & 3) == 3)
+        {
+            level = 2;
+            tbl = (uint64_t *)((entry & 0xfffff000) | 0xffffffff00000000);
+            entry = tbl[(virt >> 21) & 0x1ff];
+
+            if ((entry & 3) == 3)
+            {
+                level = 3;
+                tbl = (uint64_t *)((entry & 0xfffff000) | 0xffffffff00000000);
+                entry = tbl[(virt >> 12) & 0x1ff];
+            }
+        }
+
+        if ((entry & 1) == 0)
+            return -1;
+
+        if (level == 3)
+            break;
+
+        /* Page is a part of larger block, give it an entry of its own */
+        split_block(tbl, level, virt);
+    }
+
+    if (!(entry & MMU_READ_ONLY) == !read_only)
+        return 0;
+
+    tbl[(virt >> 12) & 0x1ff] = entry ^ MMU_READ_ONLY;
+
+    asm volatile(
+"       dsb     ishst           \n"
+"       tlbi    vae1is, %0      \n"
+"       dsb     ish             \n"
+"       isb                     \n"
+    ::"r"(virt >> 12):"memory");
+
+    return 1;
+}
+
 void mmu_unmap(uintptr_t virt, uintptr_t length)
 {
     (void)virt;
@@ -18,6 +18,7 @@
 #include "M68k.h"
 #include "HunkLoader.h"
 #include "ElfLoader.h"
+#include "CodeImage.h"
 #include "DuffCopy.h"
 #include "EmuLogo.h"
 #include "EmuFeatures.h"
@@ -267,6 +268,185 @@ asm(
 "       ret                         \n" /* Return! */
 );
 
+/*
+    Parameters of secondary cores, filled by the boot core before the cores are released:
+    MAIR, TCR, TTBR0 with identity map of the kernel, TTBR1, SCTLR, final TTBR0, VBAR and,
+    starting with the slot 8, stack tops of cores 1 to 3. Slot 7 receives the number of the
+    core which has left the firmware's spin loop and runs from the kernel
+*/
+uint64_t secondary_boot_data[11] __attribute__((aligned(64)));
+
+void _secondary_start();
+void secondary_boot(int core);
+
+asm(
+"       .globl _secondary_start     \n"
+"       .type _secondary_start,%function \n"
+"       .balign 64                  \n"
+"_secondary_start:                  \n" /* Entered with MMU off, at physical address of the kernel */
+"       mrs     x9, CurrentEL       \n"
+"       and     x9, x9, #0xc        \n"
+"       cmp     x9, #8              \n"
+"       b.eq    2f                  \n"
+"       b.lt    3f                  \n"
+#if EMU68_HOST_BIG_ENDIAN
+"       mrs     x10, SCTLR_EL3      \n"
+"       orr     x10, x10, #(1 << 25)\n"
+"       msr     SCTLR_EL3, x10      \n"
+#endif
+"       adr     x10, 2f             \n" /* Leave EL3 to EL2 */
+"       msr     ELR_EL3, x10        \n"
+"       ldr     w10, =0x000003c9    \n"
+"       msr     SPSR_EL3, x10       \n"
+"       eret                        \n"
+"2:                                 \n"
+#if EMU68_HOST_BIG_ENDIAN
+"       mrs     x10, SCTLR_EL2      \n"
+"       orr     x10, x10, #(1 << 25)\n"
+"       msr     SCTLR_EL2, x10      \n"
+#endif
+"       mov     x10, #3             \n" /* Enable CNTL access from EL1 and EL0 */
+"       msr     CNTHCTL_EL2, x10    \n"
+"       mov     x10, #0x80000000    \n" /* EL1 is AArch64 */
+"       msr     HCR_EL2, x10        \n"
+"       adr     x10, 3f             \n" /* Leave EL2 to EL1 */
+"       msr     ELR_EL2, x10        \n"
+"       ldr     w10, =0x000003c5    \n"
+"       msr     SPSR_EL2, x10       \n"
+"       eret                        \n"
+"3:                                 \n"
+#if EMU68_HOST_BIG_ENDIAN
+"       mrs     x10, SCTLR_EL1      \n"
+"       orr     x10, x10, #(1 << 25) | (1 << 24)\n"
+"       msr     SCTLR_EL1, x10      \n"
+#endif
+"       adrp    x9, secondary_boot_data \n" /* Still physical address here */
+"       add     x9, x9, :lo12:secondary_boot_data \n"
+"       mov     x10, #0x00300000    \n" /* Enable VFP in EL1 and EL0 */
+"       msr     CPACR_EL1, x10      \n"
+"       ldr     x10, [x9, #0]       \n"
+"       msr     MAIR_EL1, x10       \n"
+"       ldr     x10, [x9, #8]       \n"
+"       msr     TCR_EL1, x10        \n"
+"       ldr     x10, [x9, #16]      \n" /* Identity map of the kernel is needed until we jump to upper half */
+"       msr     TTBR0_EL1, x10      \n"
+"       ldr     x10, [x9, #24]      \n"
+"       msr     TTBR1_EL1, x10      \n"
+"       tlbi    VMALLE1             \n"
+"       dsb     sy                  \n"
+"       ic      IALLU               \n"
+"       isb     sy                  \n"
+"       ldr     x10, [x9, #32]      \n" /* MMU and caches on, same setup as on the boot core */
+"       msr     SCTLR_EL1, x10      \n"
+"       isb     sy                  \n"
+"       ldr     x10, =4f            \n"
+"       br      x10                 \n"
+"4:     adrp    x9, secondary_boot_data \n" /* Running in upper half now */
+"       add     x9, x9, :lo12:secondary_boot_data \n"
+"       ldr     x10, [x9, #40]      \n"
+"       msr     TTBR0_EL1, x10      \n"
+"       dsb     ish                 \n"
+"       tlbi    VMALLE1             \n"
+"       dsb     sy                  \n"
+"       isb                         \n"
+"       ldr     x10, [x9, #48]      \n"
+"       msr     VBAR_EL1, x10       \n"
+"       mrs     x0, MPIDR_EL1       \n"
+"       and     x0, x0, #3          \n"
+"       add     x10, x9, x0, lsl #3 \n"
+"       ldr     x10, [x10, #56]     \n" /* Stack top of core n is at offset 56 + 8*n */
+"       mov     sp, x10             \n"
+"       str     x0, [x9, #56]       \n" /* Tell the boot core this one is up */
+"       dsb     ish                 \n"
+"       sev                         \n"
+"       bl      secondary_boot      \n"
+"5:     wfe                         \n"
+"       b       5b                  \n"
+"       .ltorg                      \n"
+);
+
+/* Secondary cores, once they are up, serve as translation workers */
+void secondary_boot(int core)
+{
+    (void)core;
+    M68K_TranslationWorker();
+}
+
+/*
+    Release secondary cores parked by the firmware. Each of them waits for its entry point
+    to be written at the address given by the cpu-release-addr property of the device tree.
+*/
+void start_secondary_cores()
+{
+#if EMU68_JIT_WORKERS
+    uint64_t *id_map = tlsf_malloc_aligned(tlsf, 4096, 4096);
+    uintptr_t kernel_phys = mmu_virt2phys((uintptr_t)_secondary_start);
+    uint64_t tmp;
+
+    bzero(id_map, 4096);
+    id_map[kernel_phys >> 30] = (kernel_phys & ~0x3fffffffULL) | MMU_ISHARE | MMU_ACCESS | MMU_ATTR(0) | MMU_PAGE;
+    arm_flush_cache((uintptr_t)id_map, 4096);
+
+    asm volatile("mrs %0, MAIR_EL1":"=r"(tmp)); secondary_boot_data[0] = tmp;
+    asm volatile("mrs %0, TCR_EL1":"=r"(tmp)); secondary_boot_data[1] = tmp;
+    secondary_boot_data[2] = mmu_virt2phys((uintptr_t)id_map);
+    asm volatile("mrs %0, TTBR1_EL1":"=r"(tmp)); secondary_boot_data[3] = tmp;
+    asm volatile("mrs %0, SCTLR_EL1":"=r"(tmp)); secondary_boot_data[4] = tmp;
+    asm volatile("mrs %0, TTBR0_EL1":"=r"(tmp)); secondary_boot_data[5] = tmp;
+    asm volatile("mrs %0, VBAR_EL1":"=r"(tmp)); secondary_boot_data[6] = tmp;
+
+    for (int core=1; core <= EMU68_JIT_WORKERS && core < 4; core++)
+    {
+        char path[] = "/cpus/cpu@0";
+        of_node_t *e;
+        of_property_t *p;
+        uint64_t *release;
+        uint8_t *stack = tlsf_malloc(tlsf, EMU68_JIT_WORKER_STACK);
+
+        path[10] = '0' + core;
+        e = dt_find_node(path);
+        p = e ? dt_find_property(e, "cpu-release-addr") : NULL;
+
+        if (p == NULL || stack == NULL)
+        {
+            kprintf("[BOOT] No release address of core %d, translation worker not started\n", core);
+            continue;
+        }
+
+        secondary_boot_data[7 + core] = (uintptr_t)stack + EMU68_JIT_WORKER_STACK;
+        arm_flush_cache((uintptr_t)secondary_boot_data, sizeof(secondary_boot_data));
+
+        release = (uint64_t *)(((uintptr_t)BE32(((uint32_t *)p->op_value)[0]) << 32) | BE32(((uint32_t *)p->op_value)[1]));
+
+        kprintf("[BOOT] Starting translation worker on core %d, release address %p\n", core, release);
+
+        secondary_boot_data[7] = 0;
+        asm volatile("dsb ish":::"memory");
+
+        /* Firmware runs little endian */
+        *release = LE64(kernel_phys);
+        arm_flush_cache((uintptr_t)release, 8);
+        asm volatile("sev");
+
+        /*
+            Low memory with the spin loop and release addresses is cleared once all cores are
+            started, wait until this one runs from the kernel. Give up after 100ms.
+        */
+        {
+            uint64_t freq, start, now;
+
+            asm volatile("mrs %0, CNTFRQ_EL0; mrs %1, CNTPCT_EL0":"=r"(freq),"=r"(start));
+            do {
+                asm volatile("yield; mrs %0, CNTPCT_EL0":"=r"(now));
+            } while (__atomic_load_n(&secondary_boot_data[7], __ATOMIC_ACQUIRE) != (uint64_t)core && now - start < freq / 10);
+
+            if (secondary_boot_data[7] != (uint64_t)core)
+                kprintf("[BOOT] Core %d did not respond, translation worker not started\n", core);
+        }
+    }
+#endif
+}
+
 #if EMU68_HOST_BIG_ENDIAN
 static __attribute__((used)) const char bootstrapName[] = "Emu68 runtime/AArch64 BigEndian";
 #else
@@ -439,7 +619,7 @@ void boot(void *dtree)
             {
                 kprintf("[BOOT] Loading HUNK executable from %p-%p\n", image_start, image_end);
                 void *hunks = LoadHunkFile(image_start);
-                (void)hunks;
+                CodeImage_Attach(image_start, image_end, hunks);
                 M68K_StartEmu((void *)((intptr_t)hunks + 4), fdt);
             }
             else if (magic == 0x7f454c46)
@@ -454,6 +634,7 @@ void boot(void *dtree)
                     top_of_ram &= ~0x1fffff;
 
                     kprintf("[BOOT] Loading ELF executable from %p-%p to %p\n", image_start, image_end, top_of_ram);
+                    CodeImage_Attach(image_start, image_end, NULL);
                     void *ptr = LoadELFFile(image_start, (void*)top_of_ram);
                     M68K_StartEmu(ptr, fdt);
                 }
@@ -631,44 +812,120 @@ uint32_t fb_height  __attribute__((weak))= 0;
 
 void ExecutionLoop(struct M68KState *ctx);
 
+/* Unit started last time by ExecutionLoop, its mt_UseCount is updated if EMU68_LOG_USES is set */
+struct M68KTranslationUnit *LastUnit;
+
 struct M68KTranslationUnit *_FindUnit(uint16_t *ptr)
 {
     return M68K_FindTranslationUnit(ptr);
 }
 
-void stub_FindUnit()
+/* Stack pointer of ExecutionLoop, whatever a faulting unit has pushed is dropped by AccessFault */
+uint64_t LoopStack;
+
+/* Changes of A0-A7 made by the faulting instruction before the fault, set by SYSHandler */
+int32_t FaultWriteback[8];
+
+/* Fault status long word of 68060 */
+#define FSLW_RW_WRITE   0x00800000
+#define FSLW_RW_READ    0x01000000
+#define FSLW_TM_UDATA   0x00010000
+#define FSLW_TM_SDATA   0x00050000
+
+/*
+    Builds the access fault frame (format 4) for the m68k instruction at ctx->PC, which could not
+    access the given address. The context was saved by AccessFault with the registers as they
+    were at the time of fault.
+*/
+void M68K_AccessFault(struct M68KState *ctx, uint32_t address, uint32_t write)
+{
+    uint16_t sr = ctx->SR;
+    uint32_t fslw = (write ? FSLW_RW_WRITE : FSLW_RW_READ) | ((sr & SR_S) ? FSLW_TM_SDATA : FSLW_TM_UDATA);
+    uint32_t sp;
+
+    /* Instruction is restarted after the handler, undo (An)+ and -(An) it has done already */
+    for (int r=0; r < 8; r++)
+        ctx->A[r].u32 -= FaultWriteback[r];
+
+    if (sr & SR_S)
+        sp = ctx->A[7].u32;
+    else
+    {
+        ctx->USP.u32 = ctx->A[7].u32;
+        sp = (sr & SR_M) ? ctx->MSP.u32 : ctx->ISP.u32;
+    }
+
+    sp -= 4; *(uint32_t *)(uintptr_t)sp = fslw;
+    sp -= 4; *(uint32_t *)(uintptr_t)sp = address;
+    sp -= 2; *(uint16_t *)(uintptr_t)sp = (4 << 12) | VECTOR_ACCESS_FAULT;
+    sp -= 4; *(uint32_t *)(uintptr_t)sp = ctx->PC;
+    sp -= 2; *(uint16_t *)(uintptr_t)sp = sr;
+
+    sr = (sr & ~(SR_T0 | SR_T1)) | SR_S;
+    ctx->SR = sr;
+    ctx->A[7].u32 = sp;
+    if (sr & SR_M)
+        ctx->MSP.u32 = sp;
+    else
+        ctx->ISP.u32 = sp;
+
+    ctx->PC = *(uint32_t *)(uintptr_t)(ctx->VBR + VECTOR_ACCESS_FAULT);
+
+    /* Returns of the aborted code will not happen */
+    M68K_ClearReturnStack();
+}
+
+/*
+    Miss handler of the inline cache at indirect exits of translation units. It is entered
+    with a branch, x0 points to the cache and x30 still holds return address to ExecutionLoop.
+    Registers of m68k not preserved by the C code are saved here, together with x12 which
+    ExecutionLoop calls again if REG_PC matches TPIDR_EL1.
+*/
+void stub_IndirectMiss()
 {
     asm volatile(
-"FindUnit:                                  \n"
-"       adr     x4, ICache                  \n"
-"       eor     w0, w%[reg_pc], w%[reg_pc], lsr #16 \n"
-"       and     x0, x0, #0xffff             \n"
-"       ldr     x4, [x4]                    \n" // 1 -> 4
-"       add     x0, x0, x0, lsl #1          \n"
-"       ldr     x0, [x4, x0, lsl #3]        \n"
-"       b       1f                          \n"
-"3:     ldr     x5, [x0, #32]               \n" // 2 -> 5
-"       cmp     w5, w%[reg_pc]              \n"
-"       b.eq    2f                          \n"
-"       mov     x0, x4                      \n"
-"1:     ldr     x4, [x0]                    \n"
-"       cbnz    x4, 3b                      \n"
-"       mov     x0, #0                      \n"
-"4:     ret                                 \n"
-"2:     ldr     x4, [x0, #24]               \n"
-"       ldr     x5, [x4, #8]                \n"
-"       cbz     x5, 4b                      \n"
-"       ldr     x6, [x0, #16]               \n" // 3 -> 6
-"       stp     x4, x5, [x0, #16]           \n"
-"       add     x7, x0, #0x10               \n" // 4 -> 7
-"       str     x7, [x5]                    \n"
-"       stp     x6, x7, [x4]                \n"
-"       str     x4, [x6, #8]                \n"
-"       ret                                 \n"
+"       .globl  IndirectMiss                \n"
+"IndirectMiss:                              \n"
+"       stp     x13, x14, [sp, #-64]!       \n"
+"       stp     x15, x16, [sp, #16]         \n"
+"       stp     x17, x18, [sp, #32]         \n"
+"       stp     x30, x12, [sp, #48]         \n" // x12 holds the unit of last PC in ExecutionLoop
+"       mov     w1, w%[reg_pc]              \n"
+"       bl      M68K_ResolveIndirect        \n"
+"       ldp     x15, x16, [sp, #16]         \n"
+"       ldp     x17, x18, [sp, #32]         \n"
+"       ldp     x30, x12, [sp, #48]         \n"
+"       ldp     x13, x14, [sp], #64         \n"
+"       cbz     x0, 1f                      \n"
+"       br      x0                          \n"
+"1:     ret                                 \n"
 
 ::[reg_pc]"i"(REG_PC));
 }
 
+/*
+    Entered with a branch from the prologue of a tier 1 unit whose use counter has expired,
+    x0 points to the unit descriptor. The unit is translated again and the new code is
+    entered instead. x30 still holds return address to ExecutionLoop.
+*/
+void stub_TierUp()
+{
+    asm volatile(
+"       .globl  TierUp                      \n"
+"TierUp:                                    \n"
+"       stp     x13, x14, [sp, #-64]!       \n"
+"       stp     x15, x16, [sp, #16]         \n"
+"       stp     x17, x18, [sp, #32]         \n"
+"       str     x30, [sp, #48]              \n"
+"       bl      M68K_TierUp                 \n"
+"       ldp     x15, x16, [sp, #16]         \n"
+"       ldp     x17, x18, [sp, #32]         \n"
+"       ldr     x30, [sp, #48]              \n"
+"       ldp     x13, x14, [sp], #64         \n"
+"       br      x0                          \n"
+    );
+}
+
 void stub_ExecutionLoop()
 {
     asm volatile(
@@ -679,6 +936,9 @@ void stub_ExecutionLoop()
 "       stp     x23, x24, [sp, #3*16]       \n"
 "       stp     x21, x22, [sp, #4*16]       \n"
 "       stp     x19, x20, [sp, #5*16]       \n"
+"       mov     x1, sp                      \n"
+"       adr     x2, LoopStack               \n"
+"       str     x1, [x2]                    \n"
 "       bl      M68K_LoadContext            \n"
 "       .align 4                            \n"
 "1:                                         \n"
@@ -687,46 +947,109 @@ void stub_ExecutionLoop()
 "       cbz     w%[reg_pc], 4f              \n"
 "       ldr     w1, [x0, #%[pint]]          \n" // Load pending interrupt flag
 "       cbnz    w1, 9f                      \n" // Change context if interrupt was pending
+#if EMU68_JIT_WRITE_PROTECT
+"99:                                        \n" // Writes to translated code are caught by the MMU, no need to verify units
+#else
 "99:    ldr     w1, [x0, #%[cacr]]          \n"
 "       tbz     w1, #%[cacr_ie_bit], 2f     \n"
+#endif
 "       cmp     w2, w%[reg_pc]              \n"
-"       b.ne    13f                         \n"
+"       b.ne    12f                         \n"
 #if EMU68_LOG_USES
-"       bic     x0, x12, #0x0000001000000000\n"
-"       ldr     x1, [x0, #-%[diff]]         \n"
+"       adr     x0, LastUnit                \n"
+"       ldr     x0, [x0]                    \n"
+"       ldr     x1, [x0, #%[ucount]]        \n"
 "       add     x1, x1, #1                  \n"
-"       str     x1, [x0, #-%[diff]]         \n"
+"       str     x1, [x0, #%[ucount]]        \n"
 #endif
 "       blr     x12                         \n"
 "       b       1b                          \n"
 
+"12:                                        \n"
+#if !(EMU68_LOG_FETCHES || EMU68_LOG_USES)
+"       adr     x4, JumpCache               \n" // Check the jump cache first
+"       ldr     x4, [x4]                    \n"
+"       ubfx    x5, x%[reg_pc], #1, #%[jc_bits] \n"
+"       add     x4, x4, x5, lsl #4          \n"
+"       ldr     w1, [x4]                    \n"
+"       cmp     w1, w%[reg_pc]              \n"
+"       b.ne    13f                         \n"
+"       ldr     x12, [x4, #8]               \n"
+"       ldr     w1, [x4, #4]                \n" // Set reference bit of the unit
+"       adr     x0, jit_tlsf                \n"
+"       ldr     x0, [x0]                    \n"
+"       add     x0, x0, x1                  \n"
+"       ldrb    w1, [x0, #%[ref]]           \n"
+"       cbnz    w1, 14f                     \n"
+"       mov     w1, #1                      \n"
+"       strb    w1, [x0, #%[ref]]           \n"
+"14:    msr     TPIDR_EL1, x%[reg_pc]       \n"
+"       blr     x12                         \n"
+"       b       1b                          \n"
+#endif
+
 "13:                                        \n"
 "       adr     x4, ICache                  \n"
-"       eor     w0, w%[reg_pc], w%[reg_pc], lsr #16 \n"
-"       and     x0, x0, #0xffff             \n"
-"       ldr     x4, [x4]                    \n" // 1 -> 4
-"       add     x0, x0, x0, lsl #1          \n"
-"       ldr     x0, [x4, x0, lsl #3]        \n"
-"       b       51f                         \n"
-"53:    ldr     x5, [x0, #32]               \n" // 2 -> 5
-"       cmp     w5, w%[reg_pc]              \n"
-"       b.eq    52f                         \n"
-"       mov     x0, x4                      \n"
-"51:    ldr     x4, [x0]                    \n"
-"       cbnz    x4, 53b                     \n"
-"       b 5f                                \n"
-"52:    ldr     x4, [x0, #24]               \n"
-"       ldr     x5, [x4, #8]                \n"
-"       cbz     x5, 55f                     \n"
-"       ldr     x6, [x0, #16]               \n" // 3 -> 6
-"       stp     x4, x5, [x0, #16]           \n"
-"       add     x7, x0, #0x10               \n" // 4 -> 7
-"       str     x7, [x5]                    \n"
-"       stp     x6, x7, [x4]                \n"
-"       str     x4, [x6, #8]                \n"
+"       adr     x5, ICacheMask              \n"
+"       ldr     x4, [x4]                    \n"
+"       ldr     w5, [x5]                    \n"
+"       eor     w0, w%[reg_pc], w%[reg_pc], lsr #14 \n"
+"       and     w0, w5, w0, lsr #1          \n" // Home bucket
+"51:    add     x6, x4, x0, lsl #6          \n"
+"       mov     x7, #0                      \n"
+"52:    ldr     w1, [x6, x7, lsl #2]        \n"
+"       cmp     w1, w%[reg_pc]              \n"
+"       b.eq    53f                         \n"
+"       cmn     w1, #1                      \n" // Empty slot terminates the search
+"       b.eq    5f                          \n"
+"       add     x7, x7, #1                  \n"
+"       tbz     x7, #2, 52b                 \n"
+"       add     w0, w0, #1                  \n" // Continue with next bucket
+"       and     w0, w0, w5                  \n"
+"       b       51b                         \n"
+"53:    dmb     ishld                       \n" // Units are published by translation workers, PC is written last
+"       add     x1, x6, #%[cb_entry]        \n"
+"       ldr     x12, [x1, x7, lsl #3]       \n"
+"       add     x1, x6, #%[cb_unit]         \n"
+"       ldr     w1, [x1, x7, lsl #2]        \n"
+"       adr     x0, jit_tlsf                \n"
+"       ldr     x0, [x0]                    \n"
+"       add     x0, x0, x1                  \n" // Unit address
+"       ldrb    w1, [x0, #%[verify]]        \n" // Unit has to be verified before it runs?
+"       cbz     w1, 54f                     \n"
+"       tbnz    w1, #%[vb_suspect], 5f      \n" // Suspect since last full flush, check it once
+#if EMU68_JIT_WRITE_PROTECT
+"       mrs     x0, TPIDRRO_EL0             \n"
+"       ldr     w1, [x0, #%[cacr]]          \n" // With cache disabled it is verified on each run
+"       tbz     w1, #%[cacr_ie_bit], 2f     \n"
+"       add     x1, x6, #%[cb_unit]         \n"
+"       ldr     w1, [x1, x7, lsl #2]        \n"
+"       adr     x0, jit_tlsf                \n"
+"       ldr     x0, [x0]                    \n"
+"       add     x0, x0, x1                  \n"
+"       b       56f                         \n" // Never put it into the jump cache
+#endif
+"54:                                        \n"
+"       ldrb    w1, [x0, #%[ref]]           \n" // Set reference bit of the unit
+"       cbnz    w1, 55f                     \n"
+"       mov     w1, #1                      \n"
+"       strb    w1, [x0, #%[ref]]           \n"
 
 "55:                                        \n"
-"       ldr     x12, [x0, #%[offset]]       \n"
+"       adr     x4, JumpCache               \n" // Update the jump cache
+"       ldr     x4, [x4]                    \n"
+"       ubfx    x5, x%[reg_pc], #1, #%[jc_bits] \n"
+"       add     x4, x4, x5, lsl #4          \n"
+"       str     w%[reg_pc], [x4]            \n"
+"       add     x1, x6, #%[cb_unit]         \n"
+"       ldr     w1, [x1, x7, lsl #2]        \n"
+"       str     w1, [x4, #4]                \n"
+"       str     x12, [x4, #8]               \n"
+"56:                                        \n"
+#if EMU68_LOG_USES
+"       adr     x1, LastUnit                \n"
+"       str     x0, [x1]                    \n"
+#endif
 #if EMU68_LOG_FETCHES
 "       ldr     x1, [x0, #%[fcount]]        \n"
 "       add     x1, x1, #1                  \n"
@@ -734,10 +1057,11 @@ void stub_ExecutionLoop()
 #endif
 "       msr     TPIDR_EL1, x%[reg_pc]       \n"
 #if EMU68_LOG_USES
-"       bic     x0, x12, #0x0000001000000000\n"
-"       ldr     x1, [x0, #-%[diff]]         \n"
+"       adr     x0, LastUnit                \n"
+"       ldr     x0, [x0]                    \n"
+"       ldr     x1, [x0, #%[ucount]]        \n"
 "       add     x1, x1, #1                  \n"
-"       str     x1, [x0, #-%[diff]]         \n"
+"       str     x1, [x0, #%[ucount]]        \n"
 #endif
 "       blr     x12                         \n"
 "       b       1b                          \n"
@@ -748,6 +1072,10 @@ void stub_ExecutionLoop()
 "       msr     TPIDR_EL1, x%[reg_pc]       \n"
 "       bl      M68K_GetTranslationUnit     \n"
 "       ldr     x12, [x0, #%[offset]]       \n"
+#if EMU68_LOG_USES
+"       adr     x1, LastUnit                \n"
+"       str     x0, [x1]                    \n"
+#endif
 #if EMU68_LOG_FETCHES
 "       ldr     x1, [x0, #%[fcount]]        \n"
 "       add     x1, x1, #1                  \n"
@@ -756,10 +1084,11 @@ void stub_ExecutionLoop()
 "       mrs     x0, TPIDRRO_EL0             \n"
 "       bl      M68K_LoadContext            \n"
 #if EMU68_LOG_USES
-"       bic     x0, x12, #0x0000001000000000\n"
-"       ldr     x1, [x0, #-%[diff]]         \n"
+"       adr     x0, LastUnit                \n"
+"       ldr     x0, [x0]                    \n"
+"       ldr     x1, [x0, #%[ucount]]        \n"
 "       add     x1, x1, #1                  \n"
-"       str     x1, [x0, #-%[diff]]         \n"
+"       str     x1, [x0, #%[ucount]]        \n"
 #endif
 "       blr     x12                         \n"
 "       b       1b                          \n"
@@ -770,12 +1099,17 @@ void stub_ExecutionLoop()
 "       mvn     w0, wzr                     \n"
 "       msr     TPIDR_EL1, x0               \n"
 "       mov     w20, w%[reg_pc]             \n"
-"       bl      FindUnit                    \n"
+"       mov     w0, w%[reg_pc]              \n"
+"       bl      _FindUnit                   \n"
 "       bl      M68K_VerifyUnit             \n"
 "       cbnz    x0, 223f                    \n"
 "       mov     w0, w20                     \n"
 "       bl      M68K_GetTranslationUnit     \n"
 "223:   ldr     x12, [x0, #%[offset]]       \n"
+#if EMU68_LOG_USES
+"       adr     x1, LastUnit                \n"
+"       str     x0, [x1]                    \n"
+#endif
 #if EMU68_LOG_FETCHES
 "       ldr     x1, [x0, #%[fcount]]        \n"
 "       add     x1, x1, #1                  \n"
@@ -784,10 +1118,11 @@ void stub_ExecutionLoop()
 "       mrs     x0, TPIDRRO_EL0             \n"
 "       bl      M68K_LoadContext            \n"
 #if EMU68_LOG_USES
-"       bic     x0, x12, #0x0000001000000000\n"
-"       ldr     x1, [x0, #-%[diff]]         \n"
+"       adr     x0, LastUnit                \n"
+"       ldr     x0, [x0]                    \n"
+"       ldr     x1, [x0, #%[ucount]]        \n"
 "       add     x1, x1, #1                  \n"
-"       str     x1, [x0, #-%[diff]]         \n"
+"       str     x1, [x0, #%[ucount]]        \n"
 #endif
 "       blr     x12                         \n"
 "       b       1b                          \n"
@@ -802,6 +1137,21 @@ void stub_ExecutionLoop()
 "       ldp     x29, x30, [sp], #128        \n"
 "       ret                                 \n"
 
+"       .globl  AccessFault                 \n" // Entered from SYSHandler instead of a faulting unit,
+"AccessFault:                               \n" // x0 holds the fault address and x1 is set on write
+"       adr     x2, LoopStack               \n"
+"       ldr     x2, [x2]                    \n"
+"       mov     sp, x2                      \n"
+"       stp     x0, x1, [sp, #-16]!         \n"
+"       mrs     x0, TPIDRRO_EL0             \n"
+"       bl      M68K_SaveContext            \n"
+"       ldp     x1, x2, [sp], #16           \n"
+"       mrs     x0, TPIDRRO_EL0             \n"
+"       bl      M68K_AccessFault            \n"
+"       mrs     x0, TPIDRRO_EL0             \n"
+"       bl      M68K_LoadContext            \n"
+"       b       1b                          \n"
+
 "9:     mrs     x2, TPIDR_EL0               \n" // Get SR
 "       ubfx    w3, w2, %[srb_ipm], 3       \n" // Extract IPM
 "       mov     w4, #2                      \n"
@@ -853,8 +1203,13 @@ void stub_ExecutionLoop()
  [fcount]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_FetchCount)),
  [cacr]"i"(__builtin_offsetof(struct M68KState, CACR)),
  [offset]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_ARMEntryPoint)),
- [diff]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_ARMCode) - 
-        __builtin_offsetof(struct M68KTranslationUnit, mt_UseCount)),
+ [ref]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_Referenced)),
+ [verify]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_Verify)),
+ [vb_suspect]"i"(VERIFYB_SUSPECT),
+ [jc_bits]"i"(JCACHE_BITS),
+ [cb_unit]"i"(__builtin_offsetof(struct M68KICacheBucket, cb_Unit)),
+ [cb_entry]"i"(__builtin_offsetof(struct M68KICacheBucket, cb_ARMEntryPoint)),
+ [ucount]"i"(__builtin_offsetof(struct M68KTranslationUnit, mt_UseCount)),
  [pint]"i"(__builtin_offsetof(struct M68KState, PINT)),
  [sr]"i"(__builtin_offsetof(struct M68KState, SR)),
  [usp]"i"(__builtin_offsetof(struct M68KState, USP)),
@@ -877,6 +1232,8 @@ void M68K_StartEmu(void *addr, void *fdt)
     uint32_t m68k_pc;
 
     M68K_InitializeCache();
+    CodeImage_Preload(addr);
+    start_secondary_cores();
 
     bzero(&__m68k, sizeof(__m68k));
     bzero((void *)4, 1020);
@@ -31,6 +31,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0                      \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -47,6 +48,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x80                   \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -63,6 +65,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x100                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -79,6 +82,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x180                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -95,6 +99,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x200                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -150,6 +155,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x400                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -166,6 +172,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x480                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -182,6 +189,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x500                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -198,6 +206,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x580                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -214,6 +223,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x600                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -230,6 +240,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x680                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -246,6 +257,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x700                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -262,6 +274,7 @@ void __stub_vectors()
 "       stp x16, x17, [sp, #8*16]       \n"
 "       stp x18, x30, [sp, #9*16]       \n"
 "       mov x0, #0x780                  \n"
+"       mov x1, sp                      \n"
 "       bl SYSHandler                   \n"
 "       b ExceptionExit                 \n"
 "                                       \n"
@@ -283,11 +296,80 @@ void __stub_vectors()
 :[pint]"i"(__builtin_offsetof(struct M68KState, PINT))
 );}
 
-void SYSHandler(uint32_t vector)
+/* Entered with eret from SYSHandler in place of a faulting unit, see start.c */
+void AccessFault();
+extern int32_t FaultWriteback[8];
+
+void SYSHandler(uint32_t vector, uint64_t *frame)
 {
     uint64_t elr, spsr, esr;
     asm volatile("mrs %0, ELR_EL1; mrs %1, SPSR_EL1":"=r"(elr),"=r"(spsr));
     asm volatile("mrs %0, ESR_EL1":"=r"(esr));
+
+    /* Translation fault while another core was splitting the block, the access can be restarted */
+    if ((vector & ~0x200) == 0 && ((esr >> 26) & 0x3f) == 0x25 && (esr & 0x3c) == 0x04)
+    {
+        uint64_t far;
+        asm volatile("mrs %0, FAR_EL1":"=r"(far));
+
+        if (mmu_fault_retry(far))
+            return;
+    }
+
+#if EMU68_JIT_WRITE_PROTECT
+    /* Permission fault on write to a page with translated code, drop the code and retry */
+    if ((vector & ~0x200) == 0 && ((esr >> 26) & 0x3f) == 0x25 && (esr & (1 << 6)) && (esr & 0x3c) == 0x0c)
+    {
+        uint64_t far;
+        asm volatile("mrs %0, FAR_EL1":"=r"(far));
+
+        if (M68K_PageWritten(far))
+            return;
+    }
+#endif
+
+    /*
+        Data abort in translated code. The side table of the unit gives the m68k instruction which
+        caused it, its address goes to REG_PC in the saved frame and the exception returns into
+        AccessFault, which builds the access fault frame of m68k with the faulting address.
+        Condition codes and FPU control registers which the unit kept in temporaries are written
+        back with their values from the start of the instruction. Address registers updated by
+        the instruction before the fault are set back by M68K_AccessFault.
+    */
+    if ((vector & ~0x200) == 0 && ((esr >> 26) & 0x3f) == 0x25)
+    {
+        uint32_t m68k_pc;
+        uint8_t modified[3];
+        uint64_t far;
+
+        if (M68K_RecoverPC(elr, &m68k_pc, modified, FaultWriteback))
+        {
+            struct M68KState *ctx;
+
+            asm volatile("mrs %0, FAR_EL1; mrs %1, TPIDRRO_EL0":"=r"(far),"=r"(ctx));
+
+            if (modified[0] != 0xff)
+                asm volatile("msr TPIDR_EL0, %0"::"r"(frame[modified[0]]));
+            if (modified[1] != 0xff)
+                ctx->FPCR = frame[modified[1]];
+            if (modified[2] != 0xff)
+                ctx->FPSR = frame[modified[2]];
+
+            frame[0] = far;
+            frame[1] = (esr >> 6) & 1;
+            frame[REG_PC] = m68k_pc;
+            asm volatile("msr ELR_EL1, %0"::"r"((uintptr_t)AccessFault));
+
+            return;
+        }
+    }
+
     kprintf("[JIT:SYS] Exception with vector %04x. ELR=%p, SPSR=%08x, ESR=%p\n", vector, elr, spsr, esr);
+    {
+        uint32_t m68k_pc;
+
+        if (M68K_RecoverPC(elr, &m68k_pc, NULL, NULL))
+            kprintf("[JIT:SYS] Host code of m68k instruction at %08x\n", m68k_pc);
+    }
     while(1);
 }
@@ -0,0 +1,284 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdint.h>
+#include "support.h"
+#include "tlsf.h"
+#include "md5.h"
+#include "fingerprint.h"
+
+/*
+    Fingerprints of m68k code ranges. The method is selected once at startup, all translation
+    units share it. Snapshots are allocated from the JIT pool, which is only used with the cache
+    lock held.
+*/
+
+struct FingerprintOps {
+    const char *    fo_Name;
+    int             (*fo_Calc)(struct Fingerprint *fp, void *start, void *end);
+    int             (*fo_Check)(struct Fingerprint *fp, void *start, void *end);
+};
+
+static int md5_calc(struct Fingerprint *fp, void *start, void *end)
+{
+    struct MD5 m = CalcMD5(start, end);
+
+    fp->fp_Kind = FP_MD5;
+    fp->fp_Length = (uintptr_t)end - (uintptr_t)start;
+    fp->fp_Hash[0] = m.a;
+    fp->fp_Hash[1] = m.b;
+    fp->fp_Hash[2] = m.c;
+    fp->fp_Hash[3] = m.d;
+    fp->fp_Snapshot = NULL;
+
+    return 1;
+}
+
+static int md5_check(struct Fingerprint *fp, void *start, void *end)
+{
+    struct MD5 m = CalcMD5(start, end);
+
+    return m.a == fp->fp_Hash[0] && m.b == fp->fp_Hash[1] && m.c == fp->fp_Hash[2] && m.d == fp->fp_Hash[3];
+}
+
+#ifdef __aarch64__
+/*
+    CRC32 and CRC32C of the range, computed in parallel over 8-byte words. Both polynomials
+    together with the length of the range give a 96-bit fingerprint.
+*/
+static void crc32_sum(uint32_t *sum, void *start, void *end)
+{
+    uint64_t *p = (uint64_t *)((uintptr_t)start & ~7);
+    uint64_t *e = (uint64_t *)(((uintptr_t)end + 7) & ~7);
+    uint32_t c0 = 0xffffffff;
+    uint32_t c1 = 0xffffffff;
+
+    while (p < e)
+    {
+        uint64_t v = *p++;
+
+        asm volatile(
+"       .arch_extension crc         \n"
+"       crc32x  %w0, %w0, %2        \n"
+"       crc32cx %w1, %w1, %2        \n"
+        :"+r"(c0), "+r"(c1)
+        :"r"(v));
+    }
+
+    sum[0] = ~c0;
+    sum[1] = ~c1;
+}
+
+static int crc32_calc(struct Fingerprint *fp, void *start, void *end)
+{
+    fp->fp_Kind = FP_CRC32;
+    fp->fp_Length = (uintptr_t)end - (uintptr_t)start;
+    crc32_sum(fp->fp_Hash, start, end);
+    fp->fp_Hash[2] = (uintptr_t)start;
+    fp->fp_Hash[3] = 0;
+    fp->fp_Snapshot = NULL;
+
+    return 1;
+}
+
+static int crc32_check(struct Fingerprint *fp, void *start, void *end)
+{
+    uint32_t sum[2];
+
+    crc32_sum(sum, start, end);
+
+    return sum[0] == fp->fp_Hash[0] && sum[1] == fp->fp_Hash[1];
+}
+#endif
+
+/* Exact copy of the range. Falls back to the default method if there is no memory for it */
+static int snapshot_calc(struct Fingerprint *fp, void *start, void *end)
+{
+    uintptr_t s = (uintptr_t)start & ~7;
+    uintptr_t e = ((uintptr_t)end + 7) & ~7;
+    uint64_t *copy = tlsf_malloc(jit_tlsf, e - s);
+
+    if (copy == NULL)
+        return 0;
+
+    memcpy(copy, (void *)s, e - s);
+
+    fp->fp_Kind = FP_SNAPSHOT;
+    fp->fp_Length = e - s;
+    fp->fp_Snapshot = copy;
+
+    return 1;
+}
+
+/* Compare snapshot with the memory, four 64-bit words per iteration */
+static int snapshot_check(struct Fingerprint *fp, void *start, void *end)
+{
+    uint64_t *p = (uint64_t *)((uintptr_t)start & ~7);
+    uint64_t *c = fp->fp_Snapshot;
+    uint32_t count = fp->fp_Length / 8;
+    uint64_t diff = 0;
+
+    (void)end;
+
+    while (count >= 4)
+    {
+        diff |= (p[0] ^ c[0]) | (p[1] ^ c[1]) | (p[2] ^ c[2]) | (p[3] ^ c[3]);
+        if (diff)
+            return 0;
+        p += 4;
+        c += 4;
+        count -= 4;
+    }
+
+    while (count--)
+        diff |= *p++ ^ *c++;
+
+    return diff == 0;
+}
+
+static const struct FingerprintOps FingerprintMethods[] = {
+    [FP_MD5] = { "md5", md5_calc, md5_check },
+#ifdef __aarch64__
+    [FP_CRC32] = { "crc32", crc32_calc, crc32_check },
+#else
+    [FP_CRC32] = { "crc32", md5_calc, md5_check },
+#endif
+    [FP_SNAPSHOT] = { "snapshot", snapshot_calc, snapshot_check },
+};
+
+static uint32_t DefaultMethod = FP_MD5;
+static uint32_t Method = FP_MD5;
+
+static int HasCRC32()
+{
+#ifdef __aarch64__
+    uint64_t isar0;
+
+    asm volatile("mrs %0, ID_AA64ISAR0_EL1":"=r"(isar0));
+
+    return ((isar0 >> 16) & 15) != 0;
+#else
+    return 0;
+#endif
+}
+
+/*
+    Select the fingerprint method. CRC32 is used if the CPU implements it, "fingerprint=md5" or
+    "fingerprint=snapshot" in the boot arguments override it. With "fingerprint_benchmark" all
+    methods are measured first.
+*/
+void Fingerprint_Init(const char *args)
+{
+    if (HasCRC32())
+        DefaultMethod = FP_CRC32;
+
+    Method = DefaultMethod;
+
+    if (args && strstr(args, "fingerprint=md5"))
+        Method = FP_MD5;
+    else if (args && strstr(args, "fingerprint=snapshot"))
+        Method = FP_SNAPSHOT;
+
+    kprintf("[ICache] Using %s fingerprints of translated code\n", Fingerprint_Name());
+
+    if (args && strstr(args, "fingerprint_benchmark"))
+        Fingerprint_Benchmark();
+}
+
+const char *Fingerprint_Name()
+{
+    return FingerprintMethods[Method].fo_Name;
+}
+
+void Fingerprint_Calc(struct Fingerprint *fp, void *start, void *end)
+{
+    if (!FingerprintMethods[Method].fo_Calc(fp, start, end))
+        FingerprintMethods[DefaultMethod].fo_Calc(fp, start, end);
+}
+
+/* Returns non-zero if the range did not change since the fingerprint was taken */
+int Fingerprint_Check(struct Fingerprint *fp, void *start, void *end)
+{
+    return FingerprintMethods[fp->fp_Kind].fo_Check(fp, start, end);
+}
+
+void Fingerprint_Release(struct Fingerprint *fp)
+{
+    if (fp->fp_Snapshot)
+    {
+        tlsf_free(jit_tlsf, fp->fp_Snapshot);
+        fp->fp_Snapshot = NULL;
+    }
+}
+
+/*
+    Measure all methods over sizes typical for translation units. Mean m68k range of the units
+    is reported by M68K_DumpStats. Every method is run on the same memory, both for creating
+    and checking the fingerprint.
+*/
+void Fingerprint_Benchmark()
+{
+#ifdef __aarch64__
+    static const uint32_t sizes[] = { 32, 64, 128, 256, 512, 1024 };
+    const int rounds = 1000;
+    uint64_t freq;
+    uint8_t *buffer = tlsf_malloc(tlsf, 1024 + 64);
+
+    if (buffer == NULL)
+        return;
+
+    for (int i=0; i < 1024 + 64; i++)
+        buffer[i] = i * 37 + 11;
+
+    asm volatile("mrs %0, CNTFRQ_EL0":"=r"(freq));
+
+    kprintf("[ICache] Fingerprint benchmark, time per call in ns (calc/check):\n");
+
+    for (unsigned m=0; m < sizeof(FingerprintMethods) / sizeof(FingerprintMethods[0]); m++)
+    {
+        const struct FingerprintOps *ops = &FingerprintMethods[m];
+
+        if (m == FP_CRC32 && !HasCRC32())
+            continue;
+
+        kprintf("[ICache]   %-8s", ops->fo_Name);
+
+        for (unsigned s=0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+        {
+            struct Fingerprint fp;
+            uint64_t t0, t1, t2;
+            void *start = buffer + 6;
+            void *end = buffer + 6 + sizes[s];
+
+            fp.fp_Snapshot = NULL;
+
+            asm volatile("isb; mrs %0, CNTVCT_EL0":"=r"(t0));
+            for (int r=0; r < rounds; r++)
+            {
+                ops->fo_Calc(&fp, start, end);
+                Fingerprint_Release(&fp);
+            }
+            asm volatile("isb; mrs %0, CNTVCT_EL0":"=r"(t1));
+            ops->fo_Calc(&fp, start, end);
+            for (int r=0; r < rounds; r++)
+                ops->fo_Check(&fp, start, end);
+            asm volatile("isb; mrs %0, CNTVCT_EL0":"=r"(t2));
+            Fingerprint_Release(&fp);
+
+            kprintf(" %4d:%5d/%5d", sizes[s],
+                (uint32_t)((t1 - t0) * 1000000000ULL / freq / rounds),
+                (uint32_t)((t2 - t1) * 1000000000ULL / freq / rounds));
+        }
+
+        kprintf("\n");
+    }
+
+    tlsf_free(tlsf, buffer);
+#endif
+}
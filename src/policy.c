@@ -0,0 +1,173 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdint.h>
+#include "support.h"
+#include "config.h"
+#include "EmuFeatures.h"
+#include "policy.h"
+
+/*
+    Size limits of translation units. Every 4KB region of m68k code starts with half of the
+    maximal depth. Regions whose units are evicted before they were used again get shorter units,
+    regions whose units become hot and rarely leave through side exits get longer ones. Inlining
+    distance is cut down in regions where translated code grows too much. Regions live in a
+    direct mapped table, a region which lost its slot starts again from the defaults.
+*/
+
+static struct PolicyRegion Regions[EMU68_JIT_POLICY_REGIONS];
+static uint16_t MaxDepth;
+static uint16_t MaxInline;
+static int Adaptive;
+static uint32_t policy_grown;
+static uint32_t policy_shrunk;
+static uint32_t policy_inline_cut;
+
+static uint32_t parse_number(const char *args, const char *name, uint32_t def)
+{
+    const char *p = args ? strstr(args, name) : NULL;
+    uint32_t value = 0;
+
+    if (p == NULL)
+        return def;
+
+    p += strlen(name);
+    if (*p < '0' || *p > '9')
+        return def;
+
+    while (*p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+
+    return value;
+}
+
+/*
+    Set up the limits. "jit_depth=N" sets maximal number of m68k instructions in a unit,
+    "jit_inline=N" maximal distance of inlined branches and calls. With "jit_policy=fixed" these
+    limits are used for all units.
+*/
+void Policy_Init(const char *args)
+{
+    uint32_t depth = parse_number(args, "jit_depth=", Options.M68K_TRANSLATION_DEPTH);
+    uint32_t distance = parse_number(args, "jit_inline=", EMU68_JIT_INLINE_LIMIT);
+
+    Adaptive = EMU68_JIT_POLICY && !(args && strstr(args, "jit_policy=fixed"));
+
+    if (depth > EMU68_M68K_INSN_DEPTH)
+        depth = EMU68_M68K_INSN_DEPTH;
+    if (depth < EMU68_JIT_MIN_DEPTH)
+        depth = EMU68_JIT_MIN_DEPTH;
+    if (distance > 32768)
+        distance = 32768;
+
+    MaxDepth = depth;
+    MaxInline = distance;
+
+    for (int i=0; i < EMU68_JIT_POLICY_REGIONS; i++)
+        Regions[i].pr_Region = 0xffffffff;
+
+    kprintf("[ICache] Unit depth up to %d, inlining up to %d bytes, %s limits\n", MaxDepth, MaxInline, Adaptive ? "adaptive" : "fixed");
+}
+
+static struct PolicyRegion *Policy_GetRegion(uint16_t *pc)
+{
+    uint32_t region = (uint32_t)(uintptr_t)pc >> POLICY_REGION_SHIFT;
+    struct PolicyRegion *r = &Regions[region & (EMU68_JIT_POLICY_REGIONS - 1)];
+
+    if (r->pr_Region != region)
+    {
+        r->pr_Region = region;
+        r->pr_Depth = MaxDepth / 2 > EMU68_JIT_MIN_DEPTH ? MaxDepth / 2 : EMU68_JIT_MIN_DEPTH;
+        r->pr_Inline = MaxInline;
+    }
+
+    return r;
+}
+
+/* Maximal number of m68k instructions in unit starting at pc */
+uint16_t Policy_GetDepth(uint16_t *pc, int tier)
+{
+    return Adaptive && tier ? Policy_GetRegion(pc)->pr_Depth : MaxDepth;
+}
+
+/* Check if branch or call at pc to code distance bytes away may be followed within the unit */
+int Policy_CanInline(uint16_t *pc, int32_t distance)
+{
+    int32_t limit = Adaptive ? Policy_GetRegion(pc)->pr_Inline : MaxInline;
+
+    return distance >= -limit && distance <= limit;
+}
+
+/* Translated code expanding too much gets less inlined code */
+void Policy_UnitCreated(uint16_t *pc, uint32_t m68k_count, uint32_t arm_count)
+{
+    struct PolicyRegion *r;
+
+    if (!Adaptive || arm_count <= POLICY_EXPANSION * m68k_count)
+        return;
+
+    r = Policy_GetRegion(pc);
+    if (r->pr_Inline > 256)
+    {
+        r->pr_Inline /= 2;
+        policy_inline_cut++;
+    }
+}
+
+/* Unit removed before it was used again, the code around is not worth long units */
+void Policy_UnitEvicted(uint16_t *pc)
+{
+    struct PolicyRegion *r;
+
+    if (!Adaptive)
+        return;
+
+    r = Policy_GetRegion(pc);
+    if (r->pr_Depth > EMU68_JIT_MIN_DEPTH)
+    {
+        r->pr_Depth = r->pr_Depth / 2 > EMU68_JIT_MIN_DEPTH ? r->pr_Depth / 2 : EMU68_JIT_MIN_DEPTH;
+        policy_shrunk++;
+    }
+}
+
+/*
+    Unit became hot after EMU68_JIT_TIER_THRESHOLD runs, during which its side exits were taken
+    exit_count times. If it was mostly run to the end, the region gets longer units and inlining
+    up to the maximum. If it was mostly left early, the units get shorter.
+*/
+void Policy_UnitHot(uint16_t *pc, uint32_t exit_count)
+{
+    struct PolicyRegion *r;
+
+    if (!Adaptive)
+        return;
+
+    r = Policy_GetRegion(pc);
+    if (exit_count < EMU68_JIT_TIER_THRESHOLD / 4)
+    {
+        if (r->pr_Depth < MaxDepth)
+        {
+            r->pr_Depth = 2 * r->pr_Depth < MaxDepth ? 2 * r->pr_Depth : MaxDepth;
+            policy_grown++;
+        }
+        r->pr_Inline = MaxInline;
+    }
+    else if (exit_count > EMU68_JIT_TIER_THRESHOLD && r->pr_Depth > EMU68_JIT_MIN_DEPTH)
+    {
+        r->pr_Depth -= r->pr_Depth / 4;
+        if (r->pr_Depth < EMU68_JIT_MIN_DEPTH)
+            r->pr_Depth = EMU68_JIT_MIN_DEPTH;
+        policy_shrunk++;
+    }
+}
+
+void Policy_DumpStats()
+{
+    kprintf("[ICache] Unit depth raised: %d, lowered: %d, inlining cut: %d\n", policy_grown, policy_shrunk, policy_inline_cut);
+}
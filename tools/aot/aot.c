@@ -0,0 +1,149 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aot.h"
+#include "CodeImage.h"
+
+/*
+    emu68-aot builds the code image of an m68k executable. Code is discovered by recursive
+    descent from the entry point and the entry points of translation units are written, together
+    with the executable itself, to a file used as initrd by Emu68. At boot the units are
+    translated before the m68k code starts.
+*/
+
+#define SCAN_STACK      65536
+
+/* The decoder reports problems through kprintf */
+void kprintf(const char * format, ...)
+{
+    va_list v;
+
+    va_start(v, format);
+    vfprintf(stderr, format, v);
+    va_end(v);
+}
+
+static void put32(FILE *f, uint32_t v)
+{
+    uint8_t b[4] = { v >> 24, v >> 16, v >> 8, v };
+
+    fwrite(b, 4, 1, f);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-v] <executable> <initrd>\n", name);
+    fprintf(stderr, "Writes the HUNK or ELF executable followed by the code image to <initrd>\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct Executable ex;
+    struct Scanner sc;
+    uint32_t *stack;
+    uint8_t *file;
+    long size;
+    FILE *f;
+    int verbose = 0;
+    int arg = 1;
+    uint32_t count = 0;
+    uint32_t offset;
+
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+        verbose = 1;
+        arg++;
+    }
+
+    if (argc - arg != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    f = fopen(argv[arg], "rb");
+    if (f == NULL)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    file = malloc(size + 4);
+    if (fread(file, 1, size, f) != (size_t)size)
+    {
+        perror(argv[arg]);
+        return 1;
+    }
+    fclose(f);
+
+    if (!LoadExecutable(&ex, file, size))
+    {
+        fprintf(stderr, "%s: not a valid HUNK or ELF executable\n", argv[arg]);
+        return 1;
+    }
+
+    stack = malloc(SCAN_STACK * sizeof(uint32_t));
+    Scan_Init(&sc, ex.ex_Segments, ex.ex_SegmentCount, stack, SCAN_STACK);
+    Scan_AddEntry(&sc, ex.ex_Entry);
+    Scan_Run(&sc);
+
+    printf("%d code segments, %d instructions decoded, %d entry points", ex.ex_SegmentCount, sc.sc_Instructions, sc.sc_Entries);
+    if (sc.sc_Dropped)
+        printf(" (%d not followed)", sc.sc_Dropped);
+    printf("\n");
+
+    f = fopen(argv[arg + 1], "wb");
+    if (f == NULL)
+    {
+        perror(argv[arg + 1]);
+        return 1;
+    }
+
+    /* The executable itself, padded to a multiple of four bytes */
+    fwrite(file, 1, size, f);
+    offset = (size + 3) & ~3;
+    fwrite("\0\0\0", 1, offset - size, f);
+
+    put32(f, CI_MAGIC);
+    put32(f, CI_VERSION);
+    put32(f, size);
+    put32(f, CodeImage_CRC32(file, size));
+    put32(f, sc.sc_Entries);
+    put32(f, 0);
+
+    for (uint32_t i=0; i < ex.ex_SegmentCount; i++)
+    {
+        struct ScanSegment *s = &ex.ex_Segments[i];
+
+        for (uint32_t w=0; w < s->ss_Size / 2; w++)
+        {
+            if (s->ss_Entry[w >> 5] & (1U << (w & 31)))
+            {
+                if (verbose)
+                    printf("  %08x  segment %d + %08x\n", s->ss_Address + 2 * w, s->ss_Index, 2 * w);
+                put32(f, s->ss_Index);
+                put32(f, 2 * w);
+                count++;
+            }
+        }
+    }
+
+    put32(f, offset);
+    put32(f, CI_MAGIC);
+    fclose(f);
+
+    return count == sc.sc_Entries ? 0 : 1;
+}
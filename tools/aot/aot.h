@@ -0,0 +1,32 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#ifndef _AOT_H
+#define _AOT_H
+
+#include <stdint.h>
+#include "M68k_Scan.h"
+
+#define MAX_SEGMENTS    256
+
+/*
+    Executable loaded the way Emu68 loads it at boot, with all relocations applied. Only
+    segments holding code are given to the scanner.
+*/
+struct Executable {
+    uint8_t *           ex_File;
+    uint32_t            ex_FileSize;
+    uint32_t            ex_Entry;
+    uint32_t            ex_SegmentCount;
+    struct ScanSegment  ex_Segments[MAX_SEGMENTS];
+};
+
+int LoadExecutable(struct Executable *ex, uint8_t *file, uint32_t size);
+
+#endif /* _AOT_H */
@@ -0,0 +1,340 @@
+/*
+    Copyright © 2019 Michal Schulz <michal.schulz@gmx.de>
+    https://github.com/michalsc
+
+    This Source Code Form is subject to the terms of the
+    Mozilla Public License, v. 2.0. If a copy of the MPL was not distributed
+    with this file, You can obtain one at http://mozilla.org/MPL/2.0/.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aot.h"
+
+/*
+    Readers of HUNK and ELF executables. They follow LoadHunkFile and LoadELFFile, but keep the
+    segments in host memory and read all fields as big endian, so that they work on any host.
+*/
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static struct ScanSegment *AddSegment(struct Executable *ex, uint32_t index, uint32_t address, uint32_t size)
+{
+    struct ScanSegment *s;
+
+    if (ex->ex_SegmentCount == MAX_SEGMENTS)
+        return NULL;
+
+    s = &ex->ex_Segments[ex->ex_SegmentCount++];
+    s->ss_Address = address;
+    s->ss_Size = size;
+    s->ss_Index = index;
+    s->ss_Data = calloc(1, size + 8);
+    s->ss_Seen = calloc(4, SCAN_BITMAP_WORDS(size) + 1);
+    s->ss_Entry = calloc(4, SCAN_BITMAP_WORDS(size) + 1);
+
+    return s;
+}
+
+/* Hunks are placed exactly where LoadHunkFile places them */
+#define HUNK_POOL   0x00effff8
+
+static int LoadHunk(struct Executable *ex)
+{
+    uint8_t *file = ex->ex_File;
+    uint8_t *end = file + ex->ex_FileSize;
+    uint8_t *w = file;
+    uint32_t first, last, count;
+    uint32_t pool = HUNK_POOL;
+    uint32_t address[MAX_SEGMENTS];
+    uint32_t size[MAX_SEGMENTS];
+    uint8_t *data[MAX_SEGMENTS];
+    uint32_t current = 0;
+
+    if (ex->ex_FileSize < 20 || rd32(&w[4]) != 0)
+        return 0;
+
+    first = rd32(&w[12]);
+    last = rd32(&w[16]);
+    count = last - first + 1;
+    w += 20;
+
+    if (last < first || count > MAX_SEGMENTS || w + 4 * count > end)
+        return 0;
+
+    for (uint32_t i=0; i < count; i++)
+    {
+        size[i] = 4 * (rd32(w) & 0x3fffffff);
+        address[i] = pool + 8;
+        data[i] = calloc(1, size[i] + 8);
+        pool += (size[i] + 8 + 31) & ~31;
+        w += 4;
+    }
+
+    while (current <= last && w + 8 <= end)
+    {
+        uint32_t h = current - first;
+        uint32_t type = rd32(w);
+
+        switch (type)
+        {
+            case 0x3e9: /* Code */
+            case 0x3ea: /* Data */
+            {
+                uint32_t len = 4 * rd32(&w[4]);
+
+                if (w + 8 + len > end || (current >= first && len > size[h]))
+                    return 0;
+
+                if (current >= first)
+                {
+                    memcpy(data[h], &w[8], len);
+
+                    if (type == 0x3e9)
+                    {
+                        struct ScanSegment *s = AddSegment(ex, h, address[h], size[h]);
+
+                        if (s == NULL)
+                            return 0;
+                        free(s->ss_Data);
+                        s->ss_Data = (uint16_t *)data[h];
+                    }
+                }
+                w += 8 + len;
+                break;
+            }
+
+            case 0x3eb: /* BSS */
+                w += 8;
+                break;
+
+            case 0x3ec: /* Absolute relocations */
+            case 0x3fd: /* PC-relative relocations */
+                w += 4;
+                while (w + 4 <= end && rd32(w) != 0)
+                {
+                    uint32_t n = rd32(w);
+                    uint32_t ref = rd32(&w[4]) - first;
+
+                    w += 8;
+                    if (w + 4 * n > end || ref >= count)
+                        return 0;
+
+                    while (n--)
+                    {
+                        uint32_t off = rd32(w);
+                        uint32_t delta = address[ref];
+
+                        if (type == 0x3fd)
+                            delta -= address[h];
+                        if (current >= first && off + 4 <= size[h])
+                            wr32(&data[h][off], rd32(&data[h][off]) + delta);
+                        w += 4;
+                    }
+                }
+                w += 4;
+                break;
+
+            case 0x3f0: /* Symbols */
+                w += 4;
+                while (w + 4 <= end && rd32(w) != 0)
+                    w += 4 * (rd32(w) + 2);
+                w += 4;
+                break;
+
+            case 0x3f2: /* End of block */
+                w += 4;
+                current++;
+                break;
+
+            default:
+                w += 8 + 4 * rd32(&w[4]);
+                break;
+        }
+    }
+
+    /* LoadHunkFile returns the segment list, execution starts with the first hunk */
+    ex->ex_Entry = address[0];
+
+    return 1;
+}
+
+#define SHT_RELA        4
+#define SHT_NOBITS      8
+#define SHF_WRITE       1
+#define SHF_ALLOC       2
+#define SHF_EXECINSTR   4
+#define SHN_UNDEF       0
+#define SHN_ABS         0xfff1
+#define SHN_COMMON      0xfff2
+#define R_68K_NONE      0
+#define R_68K_32        1
+#define R_68K_PC32      4
+
+/* Base of the ELF image. It is placed below the top of RAM at boot, the image does not depend on it */
+#define ELF_BASE        0x08000000
+
+static int LoadELF(struct Executable *ex)
+{
+    uint8_t *file = ex->ex_File;
+    uint32_t shoff, shentsize, shnum;
+    uint32_t size_ro = 0;
+    uint32_t ptr_ro, ptr_rw;
+    uint32_t *address;
+    uint8_t **data;
+
+    if (ex->ex_FileSize < 52 || file[4] != 1 || file[5] != 2 || rd16(&file[0x12]) != 4)
+        return 0;
+
+    shoff = rd32(&file[0x20]);
+    shentsize = rd16(&file[0x2e]);
+    shnum = rd16(&file[0x30]);
+
+    if (shoff + shnum * shentsize > ex->ex_FileSize)
+        return 0;
+
+    address = calloc(shnum, sizeof(uint32_t));
+    data = calloc(shnum, sizeof(uint8_t *));
+
+    /* Size of read-only part, read-write sections follow it on the next page (see GetElfSize) */
+    for (uint32_t i=0; i < shnum; i++)
+    {
+        uint8_t *sh = &file[shoff + i * shentsize];
+        uint32_t align = rd32(&sh[0x20]) ? rd32(&sh[0x20]) : 1;
+
+        if ((rd32(&sh[0x08]) & (SHF_ALLOC | SHF_WRITE)) == SHF_ALLOC)
+        {
+            size_ro = (size_ro + align - 1) & ~(align - 1);
+            size_ro += (rd32(&sh[0x14]) + align - 1) & ~(align - 1);
+        }
+    }
+
+    ptr_ro = ELF_BASE;
+    ptr_rw = ptr_ro + ((size_ro + 4095) & ~4095);
+
+    for (uint32_t i=0; i < shnum; i++)
+    {
+        uint8_t *sh = &file[shoff + i * shentsize];
+        uint32_t flags = rd32(&sh[0x08]);
+        uint32_t size = rd32(&sh[0x14]);
+        uint32_t align = rd32(&sh[0x20]) ? rd32(&sh[0x20]) : 1;
+        uint32_t *ptr = (flags & SHF_WRITE) ? &ptr_rw : &ptr_ro;
+
+        if (!(flags & SHF_ALLOC) || size == 0)
+            continue;
+
+        *ptr = (*ptr + align - 1) & ~(align - 1);
+        address[i] = *ptr;
+        *ptr += size;
+
+        data[i] = calloc(1, size + 8);
+        if (rd32(&sh[0x04]) != SHT_NOBITS)
+        {
+            if (rd32(&sh[0x10]) + size > ex->ex_FileSize)
+                return 0;
+            memcpy(data[i], &file[rd32(&sh[0x10])], size);
+        }
+
+        if (flags & SHF_EXECINSTR)
+        {
+            struct ScanSegment *s = AddSegment(ex, i, address[i], size);
+
+            if (s == NULL)
+                return 0;
+            free(s->ss_Data);
+            s->ss_Data = (uint16_t *)data[i];
+        }
+    }
+
+    for (uint32_t i=0; i < shnum; i++)
+    {
+        uint8_t *rsh = &file[shoff + i * shentsize];
+        uint32_t target = rd32(&rsh[0x1c]);
+        uint8_t *symsh, *strsh;
+        uint32_t count;
+
+        if (rd32(&rsh[0x04]) != SHT_RELA || target >= shnum || data[target] == NULL || rd32(&rsh[0x24]) == 0)
+            continue;
+
+        symsh = &file[shoff + rd32(&rsh[0x18]) * shentsize];
+        strsh = &file[shoff + rd32(&symsh[0x18]) * shentsize];
+        count = rd32(&rsh[0x14]) / rd32(&rsh[0x24]);
+
+        for (uint32_t r=0; r < count; r++)
+        {
+            uint8_t *rel = &file[rd32(&rsh[0x10]) + r * 12];
+            uint32_t offset = rd32(&rel[0]);
+            uint32_t info = rd32(&rel[4]);
+            int32_t addend = (int32_t)rd32(&rel[8]);
+            uint8_t *sym = &file[rd32(&symsh[0x10]) + (info >> 8) * 16];
+            const char *name = (const char *)&file[rd32(&strsh[0x10]) + rd32(&sym[0])];
+            uint16_t shndx = rd16(&sym[14]);
+            uint32_t s;
+
+            if (shndx == SHN_UNDEF)
+                continue;
+            else if (shndx == SHN_COMMON)
+                return 0;
+            else if (shndx == SHN_ABS)
+                s = strcmp(name, "SysBase") == 0 ? 4 : rd32(&sym[4]);
+            else if (shndx < shnum)
+                s = address[shndx] + rd32(&sym[4]);
+            else
+                return 0;
+
+            if (offset + 4 > rd32(&file[shoff + target * shentsize + 0x14]))
+                return 0;
+
+            switch (info & 0xff)
+            {
+                case R_68K_32:
+                    wr32(&data[target][offset], s + addend);
+                    break;
+                case R_68K_PC32:
+                    wr32(&data[target][offset], s + addend - (address[target] + offset));
+                    break;
+                case R_68K_NONE:
+                    break;
+                default:
+                    fprintf(stderr, "Unknown relocation type %d\n", info & 0xff);
+                    return 0;
+            }
+        }
+    }
+
+    /* LoadELFFile returns the load address, execution starts there */
+    ex->ex_Entry = ELF_BASE;
+
+    return 1;
+}
+
+int LoadExecutable(struct Executable *ex, uint8_t *file, uint32_t size)
+{
+    ex->ex_File = file;
+    ex->ex_FileSize = size;
+    ex->ex_SegmentCount = 0;
+
+    if (size >= 4 && rd32(file) == 0x3f3)
+        return LoadHunk(ex);
+    else if (size >= 4 && rd32(file) == 0x7f454c46)
+        return LoadELF(ex);
+
+    return 0;
+}